@@ -1,8 +1,372 @@
 #define _CRT_SECURE_NO_WARNINGS
 #include <iostream>
 #include <fstream>
+#include <atomic>
+#include <bit>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <new>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
+//Recycles coroutine frames in per-thread free lists grouped by power of two size classes,
+//so sources that restart or await often do not go to the global heap for every frame
+class CoroutineFrameAllocator {
+public:
+    static void* allocate(size_t size) {
+        size_t sizeClass = classOf(size);
+        FreeLists* free = lists();
+        if (sizeClass == ClassCount || !free) {
+            return ::operator new(sizeClass == ClassCount ? size : MinFrameSize << sizeClass);
+        }
+
+        Block* block = free->heads[sizeClass];
+        if (block) {
+            free->heads[sizeClass] = block->next;
+            free->lengths[sizeClass]--;
+            return block;
+        }
+        return ::operator new(MinFrameSize << sizeClass);
+    }
+
+    static void deallocate(void* frame, size_t size) {
+        size_t sizeClass = classOf(size);
+        FreeLists* free = lists();
+        if (sizeClass == ClassCount || !free || free->lengths[sizeClass] == MaxCachedFrames) {
+            ::operator delete(frame);
+            return;
+        }
+
+        Block* block = static_cast<Block*>(frame);
+        block->next = free->heads[sizeClass];
+        free->heads[sizeClass] = block;
+        free->lengths[sizeClass]++;
+    }
+
+private:
+    static const size_t MinFrameSize = 64;
+    static const size_t ClassCount = 7; //64 .. 4096 bytes, bigger frames go straight to the heap
+    static const size_t MaxCachedFrames = 16;
+
+    struct Block {
+        Block* next;
+    };
+
+    struct FreeLists {
+        Block* heads[ClassCount]{};
+        size_t lengths[ClassCount]{};
+
+        ~FreeLists() {
+            for (size_t i = 0; i < ClassCount; i++) {
+                while (heads[i]) {
+                    Block* next = heads[i]->next;
+                    ::operator delete(heads[i]);
+                    heads[i] = next;
+                }
+            }
+            destroyed() = true;
+        }
+    };
+
+    static size_t classOf(size_t size) {
+        size_t sizeClass = 0;
+        while (sizeClass < ClassCount && (MinFrameSize << sizeClass) < size)
+            sizeClass++;
+        return sizeClass;
+    }
+
+    //Frames can still die after the thread's free lists (e.g. from static objects), those use the heap
+    static bool& destroyed() {
+        thread_local bool flag = false;
+        return flag;
+    }
+
+    static FreeLists* lists() {
+        if (destroyed())
+            return nullptr;
+        thread_local FreeLists instance;
+        return &instance;
+    }
+};
+
+//Lazy coroutine returned by the async pull interface. It starts when awaited and resumes
+//the awaiting coroutine through symmetric transfer, so chains of awaits do not grow the stack.
+template<typename T>
+class DataSourceTask {
+public:
+    struct promise_type {
+        std::optional<T> result;
+        std::exception_ptr exception;
+        std::coroutine_handle<> continuation;
+
+        struct FinalAwaiter {
+            bool await_ready() const noexcept {
+                return false;
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> finished) noexcept {
+                std::coroutine_handle<> continuation = finished.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+            void await_resume() const noexcept {}
+        };
+
+        DataSourceTask get_return_object() {
+            return DataSourceTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() const noexcept {
+            return {};
+        }
+        FinalAwaiter final_suspend() const noexcept {
+            return {};
+        }
+        template<typename U>
+        void return_value(U&& value) {
+            result.emplace(std::forward<U>(value));
+        }
+        void unhandled_exception() {
+            exception = std::current_exception();
+        }
+        static void* operator new(size_t size) {
+            return CoroutineFrameAllocator::allocate(size);
+        }
+        static void operator delete(void* frame, size_t size) {
+            CoroutineFrameAllocator::deallocate(frame, size);
+        }
+    };
+
+    DataSourceTask(const DataSourceTask&) = delete;
+    DataSourceTask& operator=(const DataSourceTask&) = delete;
+
+    DataSourceTask(DataSourceTask&& other) noexcept : handle(other.handle) {
+        other.handle = nullptr;
+    }
+
+    DataSourceTask& operator=(DataSourceTask&& other) noexcept {
+        if (this != &other) {
+            std::swap(handle, other.handle);
+        }
+        return *this;
+    }
+
+    ~DataSourceTask() {
+        if (handle)
+            handle.destroy();
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    T await_resume() {
+        if (handle.promise().exception)
+            std::rethrow_exception(handle.promise().exception);
+        return std::move(*handle.promise().result);
+    }
+
+private:
+    explicit DataSourceTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+//Fire and forget coroutine, used to drive a task from code that is not a coroutine itself
+struct DetachedCoroutine {
+    struct promise_type {
+        DetachedCoroutine get_return_object() const noexcept {
+            return {};
+        }
+        std::suspend_never initial_suspend() const noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() const noexcept {
+            return {};
+        }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept {
+            std::terminate();
+        }
+    };
+};
+
+//Somewhere a coroutine can be continued, e.g. the consumer's event loop. Async pulls take the
+//executor to resume on, it has to outlive the task.
+class AsyncExecutor {
+public:
+    struct ScheduleAwaiter {
+        AsyncExecutor& executor;
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> awaiting) {
+            executor.post(awaiting);
+        }
+        void await_resume() const noexcept {}
+    };
+
+    virtual ~AsyncExecutor() = default;
+
+    virtual void post(std::coroutine_handle<> coroutine) = 0;
+
+    //co_await schedule() continues the coroutine on this executor
+    ScheduleAwaiter schedule() {
+        return ScheduleAwaiter{ *this };
+    }
+};
+
+//Minimal event loop, runs posted coroutines on the thread that calls runUntil()
+class RunLoopExecutor : public AsyncExecutor {
+public:
+    //Notifies under the lock, the loop can finish and destroy the executor as soon as the lock is free
+    virtual void post(std::coroutine_handle<> coroutine) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(coroutine);
+        pending.notify_one();
+    }
+
+    //Wakes runUntil() so it checks its condition again
+    void wake() {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.notify_all();
+    }
+
+    template<typename Condition>
+    void runUntil(Condition finished) {
+        while (true) {
+            std::coroutine_handle<> coroutine;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                pending.wait(lock, [&]() { return !queue.empty() || finished(); });
+                if (queue.empty())
+                    return;
+                coroutine = queue.front();
+                queue.pop_front();
+            }
+            coroutine.resume();
+        }
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable pending;
+    std::deque<std::coroutine_handle<>> queue;
+};
+
+//Runs loop on the calling thread until the task finishes, for use outside of an event loop.
+//The task has to resume on loop (or complete inline), otherwise this waits for nothing.
+template<typename T>
+T syncWait(DataSourceTask<T>&& task, RunLoopExecutor& loop) {
+    std::atomic<bool> done(false);
+    std::optional<T> result;
+    std::exception_ptr exception;
+
+    auto waiter = [&]() -> DetachedCoroutine {
+        try {
+            result.emplace(co_await std::move(task));
+        }
+        catch (...) {
+            exception = std::current_exception();
+        }
+        done = true;
+        loop.wake();
+    };
+    waiter();
+
+    loop.runUntil([&done]() { return done.load(); });
+    if (exception)
+        std::rethrow_exception(exception);
+    return std::move(*result);
+}
+
+//Single background thread that runs blocking reads for the async interface
+class BlockingIoExecutor : public AsyncExecutor {
+public:
+    static BlockingIoExecutor& instance() {
+        static BlockingIoExecutor executor;
+        return executor;
+    }
+
+    BlockingIoExecutor(const BlockingIoExecutor&) = delete;
+    BlockingIoExecutor& operator=(const BlockingIoExecutor&) = delete;
+
+    virtual ~BlockingIoExecutor() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        pending.notify_one();
+        worker.join();
+    }
+
+    virtual void post(std::coroutine_handle<> coroutine) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(coroutine);
+        }
+        pending.notify_one();
+    }
+
+private:
+    BlockingIoExecutor() : stopping(false), worker([this]() { run(); }) {}
+
+    void run() {
+        while (true) {
+            std::coroutine_handle<> coroutine;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                pending.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (queue.empty())
+                    return; //stopping and everything already posted has run
+                coroutine = queue.front();
+                queue.pop_front();
+            }
+            coroutine.resume();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable pending;
+    std::deque<std::coroutine_handle<>> queue;
+    bool stopping;
+    std::thread worker; //last, so it starts after everything it uses
+};
+
+//Result of an async batch pull, values has count elements and belongs to the caller
+template<typename T>
+struct DataSourceBatch {
+    T* values;
+    size_t count;
+};
+
 template<typename T>
 class DataSource {
 public:
@@ -10,9 +374,45 @@ public:
 
     virtual T next() = 0;
     virtual T* next(size_t& count) = 0;
+    //Non-throwing pull, returns false at the end of the stream instead of throwing
+    virtual bool tryNext(T& element) = 0;
     virtual bool hasNext() const = 0;
     virtual bool reset() = 0;
     virtual DataSource<T>* clone() const = 0;
+    //Bytes taken from the underlying storage so far, only meaningful for I/O backed sources
+    virtual size_t bytesConsumed() const
+    {
+        return 0;
+    }
+    //Splits what is left into independent parts that together produce the same elements (in any order),
+    //the caller owns the parts and the array. nullptr means the source cannot be split.
+    virtual DataSource<T>** split(size_t parts, size_t& partCount) const
+    {
+        (void)parts;
+        partCount = 0;
+        return nullptr;
+    }
+    //Async pull, by default completes inline. I/O backed sources move the read off the caller's
+    //thread and continue the awaiting coroutine on resumeOn afterwards
+    virtual DataSourceTask<std::optional<T>> nextAsync(AsyncExecutor& resumeOn)
+    {
+        (void)resumeOn;
+        co_return this->nextOptional();
+    }
+    //count is taken by value, the lazy task may start after the caller's variable is gone
+    virtual DataSourceTask<DataSourceBatch<T>> nextBatchAsync(size_t count, AsyncExecutor& resumeOn)
+    {
+        (void)resumeOn;
+        T* values = this->next(count);
+        co_return DataSourceBatch<T>{ values, count };
+    }
+    std::optional<T> nextOptional()
+    {
+        T element{};
+        if (!this->tryNext(element))
+            return std::nullopt;
+        return element;
+    }
     T operator()()
     {
         return this->next();
@@ -36,6 +436,11 @@ public:
         return T{};
     }
 
+    bool tryNext(T& element) override {
+        element = T{};
+        return true;
+    }
+
     T* next(size_t& count) override {
         T* newNext = new T[count];
 
@@ -67,10 +472,92 @@ public:
     //The compiler will automatically generate a destructor
 };
 
+//Reads a file through its own buffer and keeps the position of the next character itself,
+//so asking for it costs no system call. Opened in binary mode, so positions are byte offsets.
+class CountingFileBuffer : public std::streambuf {
+public:
+    CountingFileBuffer() : buffer(new char[BufferSize]), base(0) {}
+
+    CountingFileBuffer(const CountingFileBuffer&) = delete;
+    CountingFileBuffer& operator=(const CountingFileBuffer&) = delete;
+
+    CountingFileBuffer(CountingFileBuffer&& other) noexcept
+        : std::streambuf(other), file(std::move(other.file)), buffer(other.buffer), base(other.base)
+    {
+        other.buffer = nullptr;
+        other.setg(nullptr, nullptr, nullptr);
+        other.base = 0;
+    }
+
+    virtual ~CountingFileBuffer() override {
+        delete[] buffer;
+    }
+
+    void swap(CountingFileBuffer& other) {
+        std::streambuf::swap(other);
+        file.swap(other.file);
+        std::swap(buffer, other.buffer);
+        std::swap(base, other.base);
+    }
+
+    bool open(const char* filename) {
+        return file.open(filename, std::ios::in | std::ios::binary) != nullptr;
+    }
+
+    bool is_open() const {
+        return file.is_open();
+    }
+
+    std::streamoff position() const {
+        return base + (gptr() - eback());
+    }
+
+protected:
+    virtual int_type underflow() override {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+
+        base += egptr() - eback(); //everything in the old buffer has been consumed
+        std::streamsize got = file.sgetn(buffer, BufferSize);
+        setg(buffer, buffer, buffer + (got > 0 ? got : 0));
+        return got > 0 ? traits_type::to_int_type(*gptr()) : traits_type::eof();
+    }
+
+    virtual pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode) override {
+        if (direction == std::ios_base::cur) {
+            if (offset == 0)
+                return pos_type(position()); //tellg() stays a plain calculation
+            return seekpos(pos_type(position() + offset), std::ios_base::in);
+        }
+        if (direction == std::ios_base::end)
+            return moveTo(file.pubseekoff(offset, std::ios_base::end, std::ios_base::in));
+        return seekpos(pos_type(offset), std::ios_base::in);
+    }
+
+    virtual pos_type seekpos(pos_type target, std::ios_base::openmode) override {
+        return moveTo(file.pubseekpos(target, std::ios_base::in));
+    }
+
+private:
+    static const std::streamsize BufferSize = 64 * 1024;
+
+    pos_type moveTo(pos_type reached) {
+        if (reached != pos_type(off_type(-1))) {
+            base = reached;
+            setg(buffer, buffer, buffer);
+        }
+        return reached;
+    }
+
+    std::filebuf file;
+    char* buffer;
+    std::streamoff base; //file offset of eback()
+};
+
 template<typename T>
 class FileDataSource : public DataSource<T> {
 public:
-    FileDataSource(const char* filename)  {
+    FileDataSource(const char* filename) : file(&buffer), rangeBegin(0), rangeEnd(Unbounded), pastRangeEnd(false) {
         if (!filename)
         {
             throw std::invalid_argument("Invalid filename");
@@ -79,41 +566,48 @@ public:
         this->filename = new char[strlen(filename) + 1];
         strcpy(this->filename, filename);
 
-        file.open(this->filename);
-        if (!file.is_open()) {
+        if (!buffer.open(this->filename)) {
             delete[] this->filename;
             throw std::runtime_error("Unable to open file");
         }
+        skipWhitespace();
+    }
+
+    //Only the elements that start inside the byte range [begin, end), used for reading one file in parallel parts
+    FileDataSource(const char* filename, std::streamoff begin, std::streamoff end) : FileDataSource(filename) {
+        if (begin < 0 || end < begin) {
+            throw std::invalid_argument("Invalid byte range"); //the delegated constructor finished, the destructor cleans up
+        }
+        rangeBegin = begin;
+        rangeEnd = end;
+        if (!seekToRangeBegin()) {
+            throw std::runtime_error("Unable to seek to the start of the range");
+        }
     }
 
-    FileDataSource(const FileDataSource& other)  {
+    FileDataSource(const FileDataSource& other)
+        : file(&buffer), rangeBegin(other.rangeBegin), rangeEnd(other.rangeEnd), pastRangeEnd(false) {
         filename = new char[strlen(other.filename) + 1];
         strcpy(filename, other.filename);
 
-        file.open(filename);
-        if (!file.is_open()) {
+        if (!buffer.open(filename)) {
             delete[] filename;
             throw std::runtime_error("Unable to open file in copy constructor");
         }
+        if (!seekToRangeBegin()) {
+            delete[] filename;
+            throw std::runtime_error("Unable to seek in copy constructor");
+        }
     }
 
 
     FileDataSource& operator=(const FileDataSource& other) {
         if (this != &other) {
-
-            std::ifstream tempFile(other.filename); //assuring that the other file is good if not the object is left unchanged
-            if (tempFile.is_open()) {
-               
-                char* newFileName = new char[strlen(other.filename) + 1];
-                strcpy(newFileName, other.filename);
-
-                
-                delete[] filename;
-                //file.close() no need for explicit call
-                filename = newFileName;
-                file = tempFile; 
+            try {
+                FileDataSource copy(other); //assuring that the other file is good if not the object is left unchanged
+                *this = std::move(copy);
             }
-            else {
+            catch (const std::runtime_error&) {
                 std::cerr << "Warning: Unable to open file in assignment operator. No changes made." << std::endl;
             }
         }
@@ -121,15 +615,24 @@ public:
     }
 
 
-    FileDataSource(FileDataSource&& other) noexcept : file(std::move(other.file)), filename(other.filename){
+    FileDataSource(FileDataSource&& other) noexcept : buffer(std::move(other.buffer)), file(&buffer), filename(other.filename),
+        rangeBegin(other.rangeBegin), rangeEnd(other.rangeEnd), pastRangeEnd(other.pastRangeEnd) {
+        file.clear(other.file.rdstate());
         other.filename = nullptr;
     }
 
     FileDataSource& operator=(FileDataSource&& other) noexcept {
         if (this != &other) {
          
-            std::swap(file, other.file);
+            //each stream keeps pointing at its own buffer, only the contents and the state move
+            buffer.swap(other.buffer);
+            std::ios::iostate state = file.rdstate();
+            file.clear(other.file.rdstate());
+            other.file.clear(state);
             std::swap(filename, other.filename);
+            std::swap(rangeBegin, other.rangeBegin);
+            std::swap(rangeEnd, other.rangeEnd);
+            std::swap(pastRangeEnd, other.pastRangeEnd);
         }
         return *this;
     }
@@ -140,82 +643,54 @@ public:
     }
 
     virtual T next() override {
-        if (file.is_open() && file.good()) {
-            T value{};
-            if (!(file >> value)) {
-                if (file.eof()) {
-                    throw std::runtime_error("Reached end of file.");
-                }
-                else {
-                    throw std::runtime_error("Failed to read from file.");
-                }
-            }
-            return value;
-        }
-        else
-        {
-            throw std::exception("Something wrong with the file");
+        T value{};
+        if (!tryNext(value)) {
+            throw std::runtime_error("Reached end of file.");
         }
+        return value;
     }
 
     virtual T* next(size_t& count) override {
-        
-        if (file.is_open() && file.good()) {
-            T* values = nullptr;
-            size_t elementsRead = 0;
-
-            try {
-                values = new T[count];
-
-                while (elementsRead < count && this->hasNext()) {
-                    T value{};
-                    file >> value;
-
-                    if (!file) {
-                        throw std::runtime_error("Failed to read from file.");
-                    }
-
-
-                    values[elementsRead] = value;
-                    elementsRead++;
-                }
-
-
-                count = elementsRead;
+        T* values = new T[count];
+        size_t elementsRead = 0;
 
+        try {
+            while (elementsRead < count && tryNext(values[elementsRead])) {
+                elementsRead++;
             }
-            catch (...) {
-                delete[] values;
-                throw;
-            }
-
-            return values;
         }
-        else
-        {
-            throw std::exception("Something wrong with the file");
+        catch (...) {
+            delete[] values;
+            throw;
         }
+
+        count = elementsRead;
+        return values;
     }
 
-    virtual bool hasNext() const override {
-        if (!file.is_open() || !file.good() || file.eof()) {
-            return false;
+    virtual bool tryNext(T& element) override {
+        if (!buffer.is_open() || file.bad()) {
+            throw std::runtime_error("Something wrong with the file");
         }
-
-       /* int nextChar = file.get();
-        if (file.eof()) {
+        if (!hasNext()) {
             return false;
         }
 
-        file.unget();*/
-        //maybe another way of checking 100% if there is a next charecter
-        //but i should remove the const 
+        if (!(file >> element)) {
+            throw std::runtime_error("Failed to read from file.");
+        }
+        skipWhitespace();
+        return true;
+    }
 
-        return file.good();
+    virtual bool hasNext() const override {
+        //the whitespace after every element is skipped right away, so eof is already
+        //set when nothing but whitespace is left and there is no failed read at the end
+        return buffer.is_open() && file.good() && !pastRangeEnd;
     }
 
     virtual bool reset() override {
-        if (!file.is_open()) {
+        if (!buffer.is_open()) {
             return false;
         }
 
@@ -224,427 +699,2555 @@ public:
             return false;
         }
 
-        file.seekg(0, std::ios::beg);
-        if (!file) {
-            return false;
+        return seekToRangeBegin();
+    }
+
+    //The read runs on the BlockingIoExecutor thread, then the awaiting coroutine continues on resumeOn.
+    //Prefer nextBatchAsync() for bulk reads so the two hops are paid once per batch
+    virtual DataSourceTask<std::optional<T>> nextAsync(AsyncExecutor& resumeOn) override {
+        std::optional<T> value;
+        std::exception_ptr error;
+
+        co_await BlockingIoExecutor::instance().schedule();
+        try {
+            value = this->nextOptional();
+        }
+        catch (...) {
+            error = std::current_exception(); //reported on resumeOn, not on the I/O thread
         }
+        co_await resumeOn.schedule();
 
-        return true;
+        if (error)
+            std::rethrow_exception(error);
+        co_return value;
+    }
+
+    virtual DataSourceTask<DataSourceBatch<T>> nextBatchAsync(size_t count, AsyncExecutor& resumeOn) override {
+        DataSourceBatch<T> batch{ nullptr, count };
+        std::exception_ptr error;
+
+        co_await BlockingIoExecutor::instance().schedule();
+        try {
+            batch.values = this->next(batch.count);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        co_await resumeOn.schedule();
+
+        if (error)
+            std::rethrow_exception(error);
+        co_return batch;
     }
 
     virtual DataSource<T>* clone() const override {
         return new FileDataSource(*this);
     }
 
+    //By byte range from the current position, every part opens the file on its own
+    virtual DataSource<T>** split(size_t parts, size_t& partCount) const override {
+        partCount = 0;
+        if (!buffer.is_open() || parts == 0) {
+            return nullptr;
+        }
+        if (!hasNext()) {
+            return new DataSource<T>*[0]; //nothing left, but still splittable
+        }
 
-private:
-    std::ifstream file;
-    char* filename;
-};
-
-
+        std::streamoff begin = static_cast<std::streamoff>(bytesConsumed());
+        std::streamoff end = rangeEnd;
+        if (end == Unbounded) {
+            std::ifstream probe(filename, std::ios::binary | std::ios::ate);
+            end = probe.tellg();
+            if (end < 0) {
+                throw std::runtime_error("Unable to get the size of the file");
+            }
+        }
 
-template<typename T>
-class ArrayDataSource : public DataSource<T> {
-public:
-    ArrayDataSource(const T* data, size_t size) : current(0), size(size)
-    {
-        if (!data)
-        {
-            throw std::invalid_argument("Data is nullptr");
+        std::streamoff step = (end - begin + static_cast<std::streamoff>(parts) - 1) / static_cast<std::streamoff>(parts);
+        if (step <= 0) {
+            step = 1;
         }
 
-        if (size == 0)
-            throw std::invalid_argument("Size cant be 0");
-        this->data = new T[size];
-        for (size_t i = 0; i < size; i++)
-        {    
-            try {
-                this->data[i] = data[i];
+        DataSource<T>** result = new DataSource<T>*[parts];
+        try {
+            for (std::streamoff from = begin; from < end && partCount < parts; from += step) {
+                result[partCount] = new FileDataSource(filename, from, std::min(from + step, end));
+                partCount++;
             }
-            catch (...)
+        }
+        catch (...) {
+            for (size_t i = 0; i < partCount; i++)
+                delete result[i];
+            delete[] result;
+            partCount = 0;
+            throw;
+        }
+        return result;
+    }
+
+    virtual size_t bytesConsumed() const override {
+        return static_cast<size_t>(buffer.position()); //kept by the buffer, no system call
+    }
+
+
+private:
+    static const std::streamoff Unbounded = -1;
+
+    void skipWhitespace() {
+        file >> std::ws; //sets only eofbit when the rest of the file is whitespace
+        if (rangeEnd != Unbounded && file.good() && buffer.position() >= rangeEnd) {
+            pastRangeEnd = true; //the next element starts in the following part
+        }
+    }
+
+    //An element that crosses the start of the range belongs to the previous part, so skip its tail
+    bool seekToRangeBegin() {
+        pastRangeEnd = false;
+        file.seekg(rangeBegin > 0 ? rangeBegin - 1 : 0, std::ios::beg);
+        if (!file) {
+            return false;
+        }
+
+        if (rangeBegin > 0 && !std::isspace(file.get())) {
+            while (file.peek() != EOF && !std::isspace(file.peek()))
+                file.get();
+        }
+        skipWhitespace();
+        return true;
+    }
+
+    CountingFileBuffer buffer;
+    std::istream file; //reads through buffer, so it has to come after it
+    char* filename;
+    std::streamoff rangeBegin;
+    std::streamoff rangeEnd;
+    bool pastRangeEnd;
+};
+
+//Describes how T is stored in a binary record file. FixedSize records take Size bytes each, others
+//are written with a 32-bit length prefix and need encodedSize(). The default stores arithmetic and
+//enum types in little endian order and swaps them on big endian hosts. Other trivially copyable types
+//are copied as their memory, padding and field order included, which is only portable between little
+//endian hosts, so elsewhere they need their own specialization that writes the fields one by one.
+template<typename T>
+struct RecordCodec {
+    static_assert(std::is_trivially_copyable_v<T>, "Provide a RecordCodec specialization for this type");
+    static_assert(std::endian::native == std::endian::little || std::is_arithmetic_v<T> || std::is_enum_v<T>,
+        "Provide a RecordCodec specialization that stores the fields of this type in little endian order");
+
+    static constexpr bool FixedSize = true;
+    static constexpr size_t Size = sizeof(T);
+
+    static void encode(const T& value, unsigned char* out) {
+        std::memcpy(out, &value, sizeof(T));
+        toLittleEndian(out);
+    }
+
+    static T decode(const unsigned char* in, size_t) {
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, in, sizeof(T));
+        toLittleEndian(bytes);
+        T value;
+        std::memcpy(&value, bytes, sizeof(T));
+        return value;
+    }
+
+private:
+    static void toLittleEndian(unsigned char* bytes) {
+        if constexpr (std::endian::native == std::endian::big && (std::is_arithmetic_v<T> || std::is_enum_v<T>)) {
+            std::reverse(bytes, bytes + sizeof(T)); //the same swap goes both ways
+        }
+        else {
+            (void)bytes;
+        }
+    }
+};
+
+template<>
+struct RecordCodec<std::string> {
+    static constexpr bool FixedSize = false;
+
+    static size_t encodedSize(const std::string& value) {
+        return value.size();
+    }
+
+    static void encode(const std::string& value, unsigned char* out) {
+        std::memcpy(out, value.data(), value.size());
+    }
+
+    static std::string decode(const unsigned char* in, size_t length) {
+        return std::string(reinterpret_cast<const char*>(in), length);
+    }
+};
+
+enum class RecordLayout {
+    Raw,    //fixed-size records back to back without any framing, like a plain dump of an array
+    Blocked //blocks with a header and a checksum, written by BinaryRecordWriter
+};
+
+//Block header, every field is a little endian uint32: magic, record count, payload bytes, checksum
+const size_t RecordBlockHeaderSize = 16;
+const std::uint32_t RecordBlockMagic = 0x4B425344; //"DSBK"
+
+inline void storeLittleEndian32(std::uint32_t value, unsigned char* out) {
+    for (size_t i = 0; i < 4; i++)
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+inline std::uint32_t loadLittleEndian32(const unsigned char* in) {
+    std::uint32_t value = 0;
+    for (size_t i = 0; i < 4; i++)
+        value |= static_cast<std::uint32_t>(in[i]) << (8 * i);
+    return value;
+}
+
+//FNV-1a, cheap enough to run per block and catches torn or corrupted writes
+inline std::uint32_t recordBlockChecksum(const unsigned char* data, size_t length) {
+    std::uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//Positional reads on a raw descriptor. With directIo the page cache is bypassed where the
+//platform and file system allow it (O_DIRECT), callers then have to read aligned blocks.
+//A file system that accepts O_DIRECT at open() but refuses the reads gets the page cache instead.
+class RecordFile {
+public:
+    RecordFile(const char* filename, bool directIo) : descriptor(-1), filename(filename), direct(false) {
+#ifdef _WIN32
+        (void)directIo;
+        descriptor = _open(filename, _O_RDONLY | _O_BINARY);
+#else
+#ifdef O_DIRECT
+        if (directIo) {
+            descriptor = ::open(filename, O_RDONLY | O_DIRECT);
+            direct = descriptor >= 0;
+        }
+#else
+        (void)directIo;
+#endif
+        if (descriptor < 0)
+            descriptor = ::open(filename, O_RDONLY); //some file systems refuse O_DIRECT, use the page cache there
+#endif
+        if (descriptor < 0) {
+            throw std::runtime_error("Unable to open file");
+        }
+    }
+
+    RecordFile(const RecordFile&) = delete;
+    RecordFile& operator=(const RecordFile&) = delete;
+
+    ~RecordFile() {
+#ifdef _WIN32
+        _close(descriptor);
+#else
+        ::close(descriptor);
+#endif
+    }
+
+    unsigned long long size() const {
+#ifdef _WIN32
+        long long end = _lseeki64(descriptor, 0, SEEK_END);
+#else
+        off_t end = ::lseek(descriptor, 0, SEEK_END);
+#endif
+        if (end < 0) {
+            throw std::runtime_error("Unable to get the size of the file");
+        }
+        return static_cast<unsigned long long>(end);
+    }
+
+    //Reads until length bytes are in or the file ends, returns how many were read
+    size_t readAt(unsigned char* buffer, size_t length, unsigned long long offset) {
+        size_t done = 0;
+        while (done < length) {
+#ifdef _WIN32
+            if (_lseeki64(descriptor, static_cast<long long>(offset + done), SEEK_SET) < 0) {
+                throw std::runtime_error("Failed to read from file.");
+            }
+            int got = _read(descriptor, buffer + done, static_cast<unsigned>(length - done));
+#else
+            ssize_t got = ::pread(descriptor, buffer + done, length - done, static_cast<off_t>(offset + done));
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got < 0 && errno == EINVAL && direct) {
+                reopenBuffered();
+                continue;
+            }
+#endif
+            if (got < 0) {
+                throw std::runtime_error("Failed to read from file.");
+            }
+            if (got == 0)
+                break;
+            done += static_cast<size_t>(got);
+        }
+        return done;
+    }
+
+private:
+#ifndef _WIN32
+    void reopenBuffered() {
+        int buffered = ::open(filename.c_str(), O_RDONLY);
+        if (buffered < 0) {
+            throw std::runtime_error("Unable to open file");
+        }
+        ::close(descriptor);
+        descriptor = buffered;
+        direct = false;
+    }
+#endif
+
+    int descriptor;
+    std::string filename; //kept to reopen without O_DIRECT
+    bool direct;
+};
+
+//Reads records of T from a binary file in large aligned blocks and decodes them in batches.
+//Raw files are split by record range for parallel reduction, Blocked files are read sequentially.
+template<typename T, typename Codec = RecordCodec<T>>
+class BinaryFileDataSource : public DataSource<T> {
+public:
+    BinaryFileDataSource(const char* filename, RecordLayout layout = RecordLayout::Raw,
+        bool verifyChecksums = true, bool directIo = false)
+        : filename(nullptr), file(nullptr), buffer(nullptr), layout(layout),
+        verifyChecksums(verifyChecksums), directIo(directIo), rangeBegin(0), rangeEnd(0)
+    {
+        if (!filename)
+        {
+            throw std::invalid_argument("Invalid filename");
+        }
+        if (layout == RecordLayout::Raw && !Codec::FixedSize)
+        {
+            throw std::invalid_argument("Raw layout needs fixed-size records");
+        }
+        open(filename);
+        rangeEnd = fileSize;
+        reset();
+    }
+
+    //Only the raw records that start inside the byte range [begin, end)
+    BinaryFileDataSource(const char* filename, unsigned long long begin, unsigned long long end, bool directIo = false)
+        : BinaryFileDataSource(filename, RecordLayout::Raw, false, directIo)
+    {
+        unsigned long long recordSize = recordBytes();
+        if (end < begin || end > fileSize || begin % recordSize != 0) {
+            throw std::invalid_argument("Invalid byte range"); //the delegated constructor finished, the destructor cleans up
+        }
+        rangeBegin = begin;
+        rangeEnd = end;
+        reset();
+    }
+
+    //Like FileDataSource the copy opens the file again and starts from the beginning
+    BinaryFileDataSource(const BinaryFileDataSource& other)
+        : filename(nullptr), file(nullptr), buffer(nullptr), layout(other.layout),
+        verifyChecksums(other.verifyChecksums), directIo(other.directIo),
+        rangeBegin(other.rangeBegin), rangeEnd(other.rangeEnd)
+    {
+        open(other.filename);
+        reset();
+    }
+
+    BinaryFileDataSource(BinaryFileDataSource&& other) noexcept
+        : filename(nullptr), file(nullptr), buffer(nullptr), layout(RecordLayout::Raw),
+        verifyChecksums(true), directIo(false), rangeBegin(0), rangeEnd(0)
+    {
+        swap(other);
+    }
+
+    BinaryFileDataSource& operator=(const BinaryFileDataSource& other) {
+        if (this != &other) {
+            BinaryFileDataSource copy(other); //if the file cannot be opened the object is left unchanged
+            swap(copy);
+        }
+        return *this;
+    }
+
+    BinaryFileDataSource& operator=(BinaryFileDataSource&& other) noexcept {
+        if (this != &other) {
+            swap(other);
+        }
+        return *this;
+    }
+
+    virtual ~BinaryFileDataSource() override {
+        delete[] filename;
+        delete file;
+        if (buffer)
+            ::operator delete(buffer, std::align_val_t(IoAlignment));
+    }
+
+    virtual T next() override {
+        T value{};
+        if (!tryNext(value)) {
+            throw std::runtime_error("Reached end of file.");
+        }
+        return value;
+    }
+
+    virtual T* next(size_t& count) override {
+        T* values = new T[count];
+        size_t elementsRead = 0;
+
+        try {
+            if constexpr (std::is_same_v<Codec, RecordCodec<T>> && Codec::FixedSize
+                && std::is_trivially_copyable_v<T> && std::endian::native == std::endian::little) {
+                if (layout == RecordLayout::Raw) {
+                    //the records already have the in-memory representation, copy the whole batch at once
+                    unsigned long long left = (rangeEnd - position) / sizeof(T);
+                    elementsRead = static_cast<size_t>(std::min<unsigned long long>(count, left));
+                    if (!readBytes(reinterpret_cast<unsigned char*>(values), elementsRead * sizeof(T))) {
+                        throw std::runtime_error("Truncated record");
+                    }
+                }
+            }
+            while (elementsRead < count && tryNext(values[elementsRead]))
+                elementsRead++;
+        }
+        catch (...) {
+            delete[] values;
+            throw;
+        }
+
+        count = elementsRead;
+        return values;
+    }
+
+    virtual bool tryNext(T& element) override {
+        if constexpr (Codec::FixedSize) {
+            if (layout == RecordLayout::Raw) {
+                if (position >= rangeEnd)
+                    return false;
+
+                unsigned char record[Codec::Size];
+                if (rangeEnd - position < Codec::Size || !readBytes(record, Codec::Size)) {
+                    throw std::runtime_error("Truncated record");
+                }
+                element = Codec::decode(record, Codec::Size);
+                return true;
+            }
+        }
+
+        while (blockRecordsLeft == 0) {
+            if (position >= rangeEnd)
+                return false;
+            loadBlock();
+        }
+
+        size_t length = recordBytes();
+        if constexpr (!Codec::FixedSize) {
+            if (block.size() - blockCursor < 4) {
+                throw std::runtime_error("Corrupted block");
+            }
+            length = loadLittleEndian32(block.data() + blockCursor);
+            blockCursor += 4;
+        }
+        if (block.size() - blockCursor < length) {
+            throw std::runtime_error("Corrupted block");
+        }
+        element = Codec::decode(block.data() + blockCursor, length);
+        blockCursor += length;
+        blockRecordsLeft--;
+        return true;
+    }
+
+    virtual bool hasNext() const override {
+        return blockRecordsLeft > 0 || position < rangeEnd;
+    }
+
+    virtual bool reset() override {
+        position = rangeBegin;
+        bufferStart = 0;
+        bufferLength = 0;
+        block.clear();
+        blockCursor = 0;
+        blockRecordsLeft = 0;
+        return true;
+    }
+
+    //Like FileDataSource the read runs on the BlockingIoExecutor thread and the awaiting coroutine
+    //continues on resumeOn. Records that are already buffered are decoded inline, without the hops
+    virtual DataSourceTask<std::optional<T>> nextAsync(AsyncExecutor& resumeOn) override {
+        bool reads = !isBuffered(1);
+        std::optional<T> value;
+        std::exception_ptr error;
+
+        if (reads)
+            co_await BlockingIoExecutor::instance().schedule();
+        try {
+            value = this->nextOptional();
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        if (reads)
+            co_await resumeOn.schedule();
+
+        if (error)
+            std::rethrow_exception(error);
+        co_return value;
+    }
+
+    virtual DataSourceTask<DataSourceBatch<T>> nextBatchAsync(size_t count, AsyncExecutor& resumeOn) override {
+        bool reads = !isBuffered(count);
+        DataSourceBatch<T> batch{ nullptr, count };
+        std::exception_ptr error;
+
+        if (reads)
+            co_await BlockingIoExecutor::instance().schedule();
+        try {
+            batch.values = this->next(batch.count);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        if (reads)
+            co_await resumeOn.schedule();
+
+        if (error)
+            std::rethrow_exception(error);
+        co_return batch;
+    }
+
+    virtual DataSource<T>* clone() const override {
+        return new BinaryFileDataSource(*this);
+    }
+
+    virtual size_t bytesConsumed() const override {
+        return static_cast<size_t>(position);
+    }
+
+    //Raw files by record range from the current position, every part opens the file on its own
+    virtual DataSource<T>** split(size_t parts, size_t& partCount) const override {
+        partCount = 0;
+        if (layout != RecordLayout::Raw || parts == 0) {
+            return nullptr;
+        }
+
+        unsigned long long recordSize = recordBytes();
+        unsigned long long records = (rangeEnd - position) / recordSize;
+        if (parts > records)
+            parts = static_cast<size_t>(records);
+
+        DataSource<T>** result = new DataSource<T>*[parts];
+        unsigned long long begin = position;
+        try {
+            for (size_t i = 0; i < parts; i++) {
+                unsigned long long length = records / parts + (i < records % parts ? 1 : 0);
+                result[i] = new BinaryFileDataSource(filename, begin, begin + length * recordSize, directIo);
+                begin += length * recordSize;
+                partCount++;
+            }
+        }
+        catch (...) {
+            for (size_t i = 0; i < partCount; i++)
+                delete result[i];
+            delete[] result;
+            partCount = 0;
+            throw;
+        }
+        return result;
+    }
+
+private:
+    static const size_t IoBufferSize = 1024 * 1024;
+    static const size_t IoAlignment = 4096; //enough for O_DIRECT on common devices
+
+    static constexpr size_t recordBytes() {
+        if constexpr (Codec::FixedSize)
+            return Codec::Size;
+        else
+            return 0;
+    }
+
+    void open(const char* name) {
+        filename = new char[strlen(name) + 1];
+        strcpy(filename, name);
+        try {
+            file = new RecordFile(filename, directIo);
+            fileSize = file->size();
+            buffer = static_cast<unsigned char*>(::operator new(IoBufferSize, std::align_val_t(IoAlignment)));
+        }
+        catch (...) {
+            delete file;
+            delete[] filename;
+            throw;
+        }
+    }
+
+    //True when the next count records come from memory (or the range is over), so no read is needed
+    bool isBuffered(size_t count) const {
+        if (layout == RecordLayout::Blocked)
+            return blockRecordsLeft >= count || (blockRecordsLeft == 0 && position >= rangeEnd);
+
+        unsigned long long bytes = static_cast<unsigned long long>(recordBytes()) * count;
+        return position >= rangeEnd
+            || (position >= bufferStart && position + bytes <= bufferStart + bufferLength);
+    }
+
+    //Buffers always start on an aligned offset and have the full size, as direct I/O requires
+    bool readBytes(unsigned char* out, size_t length) {
+        while (length > 0) {
+            if (position < bufferStart || position >= bufferStart + bufferLength) {
+                bufferStart = position - position % IoAlignment;
+                bufferLength = file->readAt(buffer, IoBufferSize, bufferStart);
+                if (position >= bufferStart + bufferLength)
+                    return false;
+            }
+
+            size_t offset = static_cast<size_t>(position - bufferStart);
+            size_t taken = std::min(length, bufferLength - offset);
+            std::memcpy(out, buffer + offset, taken);
+            out += taken;
+            length -= taken;
+            position += taken;
+        }
+        return true;
+    }
+
+    void loadBlock() {
+        unsigned char header[RecordBlockHeaderSize];
+        if (!readBytes(header, RecordBlockHeaderSize) || loadLittleEndian32(header) != RecordBlockMagic) {
+            throw std::runtime_error("Corrupted block header");
+        }
+
+        block.resize(loadLittleEndian32(header + 8));
+        if (!readBytes(block.data(), block.size())) {
+            throw std::runtime_error("Truncated block");
+        }
+        if (verifyChecksums && recordBlockChecksum(block.data(), block.size()) != loadLittleEndian32(header + 12)) {
+            throw std::runtime_error("Checksum mismatch in block");
+        }
+        blockCursor = 0;
+        blockRecordsLeft = loadLittleEndian32(header + 4);
+    }
+
+    void swap(BinaryFileDataSource& other) noexcept {
+        std::swap(filename, other.filename);
+        std::swap(file, other.file);
+        std::swap(buffer, other.buffer);
+        std::swap(layout, other.layout);
+        std::swap(verifyChecksums, other.verifyChecksums);
+        std::swap(directIo, other.directIo);
+        std::swap(fileSize, other.fileSize);
+        std::swap(rangeBegin, other.rangeBegin);
+        std::swap(rangeEnd, other.rangeEnd);
+        std::swap(position, other.position);
+        std::swap(bufferStart, other.bufferStart);
+        std::swap(bufferLength, other.bufferLength);
+        std::swap(block, other.block);
+        std::swap(blockCursor, other.blockCursor);
+        std::swap(blockRecordsLeft, other.blockRecordsLeft);
+    }
+
+    char* filename;
+    RecordFile* file;
+    unsigned char* buffer;
+    RecordLayout layout;
+    bool verifyChecksums;
+    bool directIo;
+    unsigned long long fileSize{};
+    unsigned long long rangeBegin;
+    unsigned long long rangeEnd;
+    unsigned long long position{};
+    unsigned long long bufferStart{};
+    size_t bufferLength{};
+    std::vector<unsigned char> block; //payload of the current block in the Blocked layout
+    size_t blockCursor{};
+    size_t blockRecordsLeft{};
+};
+
+//Writes files for BinaryFileDataSource. Blocked files are flushed in blocks of about blockBytes
+template<typename T, typename Codec = RecordCodec<T>>
+class BinaryRecordWriter {
+public:
+    BinaryRecordWriter(const char* filename, RecordLayout layout = RecordLayout::Blocked, size_t blockBytes = 64 * 1024)
+        : file(filename, std::ios::binary), layout(layout), blockBytes(blockBytes), blockRecords(0)
+    {
+        if (layout == RecordLayout::Raw && !Codec::FixedSize)
+        {
+            throw std::invalid_argument("Raw layout needs fixed-size records");
+        }
+        if (!file.is_open()) {
+            throw std::runtime_error("Unable to open file");
+        }
+    }
+
+    BinaryRecordWriter(const BinaryRecordWriter&) = delete;
+    BinaryRecordWriter& operator=(const BinaryRecordWriter&) = delete;
+
+    ~BinaryRecordWriter() {
+        try {
+            flush();
+        }
+        catch (...) {
+            std::cerr << "Warning: Unable to write the last block of the record file." << std::endl;
+        }
+    }
+
+    void write(const T& value) {
+        size_t length = 0;
+        if constexpr (Codec::FixedSize)
+            length = Codec::Size;
+        else
+            length = Codec::encodedSize(value);
+
+        size_t start = pending.size();
+        pending.resize(start + (Codec::FixedSize ? 0 : 4) + length);
+        if constexpr (!Codec::FixedSize) {
+            storeLittleEndian32(static_cast<std::uint32_t>(length), pending.data() + start);
+            start += 4;
+        }
+        Codec::encode(value, pending.data() + start);
+        blockRecords++;
+
+        if (pending.size() >= blockBytes)
+            flush();
+    }
+
+    void flush() {
+        if (blockRecords == 0)
+            return;
+
+        if (layout == RecordLayout::Blocked) {
+            unsigned char header[RecordBlockHeaderSize];
+            storeLittleEndian32(RecordBlockMagic, header);
+            storeLittleEndian32(static_cast<std::uint32_t>(blockRecords), header + 4);
+            storeLittleEndian32(static_cast<std::uint32_t>(pending.size()), header + 8);
+            storeLittleEndian32(recordBlockChecksum(pending.data(), pending.size()), header + 12);
+            file.write(reinterpret_cast<const char*>(header), RecordBlockHeaderSize);
+        }
+        file.write(reinterpret_cast<const char*>(pending.data()), pending.size());
+        file.flush();
+        if (!file) {
+            throw std::runtime_error("Error writing to binary file");
+        }
+        pending.clear();
+        blockRecords = 0;
+    }
+
+private:
+    std::ofstream file;
+    RecordLayout layout;
+    size_t blockBytes;
+    std::vector<unsigned char> pending;
+    size_t blockRecords;
+};
+
+
+
+
+template<typename T>
+class ArrayDataSource : public DataSource<T> {
+public:
+    ArrayDataSource(const T* data, size_t size) : current(0), size(size)
+    {
+        if (!data)
+        {
+            throw std::invalid_argument("Data is nullptr");
+        }
+
+        if (size == 0)
+            throw std::invalid_argument("Size cant be 0");
+        this->data = new T[size];
+        for (size_t i = 0; i < size; i++)
+        {    
+            try {
+                this->data[i] = data[i];
+            }
+            catch (...)
             {
                 delete[] this->data;
                 throw;
             }
         }
     }
-    ArrayDataSource(const ArrayDataSource& other)
-    {
-        this->data = new T[other.size];
-        for (size_t i = 0; i < other.size; i++)
-        {
-            try {
-                this->data[i] = other.data[i];
-            }
-            catch (...)
-            {
-                delete[] this->data;
-                throw;
-            }
+    ArrayDataSource(const ArrayDataSource& other)
+    {
+        this->data = new T[other.size];
+        for (size_t i = 0; i < other.size; i++)
+        {
+            try {
+                this->data[i] = other.data[i];
+            }
+            catch (...)
+            {
+                delete[] this->data;
+                throw;
+            }
+        }
+
+        this->size = other.size;
+        this->current = other.current;
+    }
+    ArrayDataSource(ArrayDataSource&& other) noexcept : data(nullptr), current(0), size(0)
+    {
+        *this = std::move(other);
+    }
+    ArrayDataSource& operator=(const ArrayDataSource& other)
+    {
+        if (this != &other)
+        {
+            T* newData = new T[other.size];
+
+            for (size_t i = 0; i < other.size; i++)
+            {
+                try {
+                    newData[i] = other.data[i];
+                }
+                catch (...)
+                {
+                    delete[] newData;
+                    throw;
+                }
+            }
+
+            delete[] this->data;
+            this->data = newData;
+            this->size = other.size;
+            this->current = other.current;
+        }
+
+        return *this;
+    }
+    ArrayDataSource& operator=(ArrayDataSource&& other) noexcept
+    {
+        if (this != &other) {
+            std::swap(this->data, other.data);
+            std::swap(this->size, other.size);
+            std::swap(this->current, other.current);
+        }
+        return *this;
+    }
+    virtual T next() override {
+        if (this->size <= this->current)
+            throw std::invalid_argument("Index out of range");
+        return this->data[this->current++];
+    }
+
+    virtual bool tryNext(T& element) override {
+        if (this->size <= this->current)
+            return false;
+        element = this->data[this->current++];
+        return true;
+    }
+
+    virtual T* next(size_t& count) override {
+        size_t available = size - current;
+        size_t actualCount = (count < available) ? count : available;
+
+        T* values = nullptr;
+        try {
+            values = new T[actualCount];
+
+            for (size_t i = 0; i < actualCount; i++) {
+                values[i] = this->data[current];
+                current++;
+            }
+            count = actualCount;
+
+        }
+        catch (...) {
+            delete[] values;  
+            throw; 
+        }
+
+        return values;
+    }
+
+
+    virtual bool hasNext() const override {
+        return this->current < this->size;
+    }
+
+    virtual bool reset() override {
+        this->current = 0;
+        return true;
+    }
+
+    //By index range, the parts copy only their own slice
+    virtual DataSource<T>** split(size_t parts, size_t& partCount) const override {
+        partCount = 0;
+        if (parts == 0) {
+            return nullptr;
+        }
+
+        size_t remaining = this->size - this->current;
+        if (parts > remaining)
+            parts = remaining;
+
+        DataSource<T>** result = new DataSource<T>*[parts];
+        size_t begin = this->current;
+        for (size_t i = 0; i < parts; i++) {
+            size_t length = remaining / parts + (i < remaining % parts ? 1 : 0);
+            try {
+                result[i] = new ArrayDataSource(this->data + begin, length);
+            }
+            catch (...) {
+                for (size_t j = 0; j < i; j++)
+                    delete result[j];
+                delete[] result;
+                partCount = 0;
+                throw;
+            }
+            begin += length;
+            partCount++;
+        }
+        return result;
+    }
+
+    ArrayDataSource<T>& operator+=(const T& element) {
+        T* newData = new T[this->size + 1];
+        for (size_t i = 0; i < this->size; i++) {
+            try {
+                newData[i] = this->data[i];
+            }
+            catch (...) {
+                delete[] newData;
+                throw;
+            }
+        }
+        try {
+            newData[this->size] = element;
+        }
+        catch (...)
+        {
+            delete[] newData;
+            throw;
+        }
+        delete[] this->data;
+        this->data = newData;
+        this->size++;
+        return *this;
+    }
+
+    ArrayDataSource<T>& operator--() {
+        if (this->current > 0) {
+            --this->current;
+        }
+        return *this;
+    }
+
+    ArrayDataSource<T>& operator--(int) {
+        ArrayDataSource<T>& temp = *this;
+        --(*this);
+        return temp;
+    }
+    virtual ~ArrayDataSource() override
+    {
+        delete[] this->data;
+    }
+
+    virtual DataSource<T>* clone() const override
+    {
+        return new ArrayDataSource(*this);
+    }
+
+private:
+    T* data;
+    size_t current;
+    size_t size;
+};
+
+template<typename T>
+ArrayDataSource<T> operator+(const ArrayDataSource<T>& arr, const T& element) {
+    ArrayDataSource<T> result(arr);
+    result += element;
+    return result;
+}
+
+template<typename T>
+class AlternateDataSource : public DataSource<T> {
+public:
+    AlternateDataSource(DataSource<T>** sources, size_t sourceCount)
+        :sourceCount(sourceCount), currentSource(0)
+    {
+        if (!sources)
+        {
+            throw std::invalid_argument("Sources is nullptr");
+        }
+
+        if (sourceCount == 0)
+        {
+            throw std::invalid_argument("Soruce count is 0");
+        }
+        this->sources = new DataSource<T>*[sourceCount];
+
+        for (size_t i = 0; i < sourceCount; i++) {
+            try {
+                this->sources[i] = sources[i]->clone();
+            }
+            catch (...) {
+                for (size_t j = 0; j < i; j++)
+                    delete this->sources[j];
+                delete[] this->sources;
+                throw;
+            }
+        }
+    }
+
+    AlternateDataSource(const AlternateDataSource& other)
+        : sources(nullptr), sourceCount(other.sourceCount), currentSource(other.currentSource)
+    {
+        this->sources = new DataSource<T>*[other.sourceCount];
+
+        for (size_t i = 0; i < other.sourceCount; i++) {
+            try {
+                this->sources[i] = other.sources[i]->clone();
+            }
+            catch (...) {
+                for (size_t j = 0; j < i; j++)
+                    delete this->sources[j];
+                delete[] this->sources;
+                throw;
+            }
+        }
+    }
+
+    AlternateDataSource(AlternateDataSource&& other) noexcept
+        : sources(other.sources), sourceCount(other.sourceCount), currentSource(other.currentSource)
+    {
+        other.sources = nullptr;
+        other.sourceCount = 0;
+        other.currentSource = 0;
+    }
+
+    AlternateDataSource& operator=(const AlternateDataSource& other)
+    {
+        if (this != &other) {
+            DataSource<T>** newData = new DataSource<T>*[other.sourceCount];
+
+            for (size_t i = 0; i < other.sourceCount; i++) {
+                try {
+                    newData[i] = other.sources[i]->clone();
+                }
+                catch (...) {
+                    for (size_t j = 0; j < i; j++)
+                        delete newData[j];
+                    delete[] newData;
+                    throw;
+                }
+            }
+
+            for (size_t i = 0; i < this->sourceCount; i++) {
+                delete this->sources[i];
+            }
+            delete[] this->sources;
+
+            this->sources = newData;
+            this->sourceCount = other.sourceCount;
+            this->currentSource = other.currentSource;
+        }
+
+        return *this;
+    }
+
+    AlternateDataSource& operator=(AlternateDataSource&& other) noexcept
+    {
+        if (this != &other) {
+            std::swap(this->sources, other.sources);
+            std::swap(this->sourceCount, other.sourceCount);
+            std::swap(this->currentSource, other.currentSource);
+        }
+        return *this;
+    }
+
+    virtual T next() override {
+        T value{};
+        if (!tryNext(value))
+            return T{};
+        return value;
+    }
+
+    virtual T* next(size_t& count) override {
+        if (count == 0)
+            throw std::invalid_argument("Invalid count for next");
+
+        T* values = new T[count];
+        size_t elemtsRead{};
+        try {
+            while (elemtsRead < count && tryNext(values[elemtsRead]))
+                elemtsRead++;
+        }
+        catch (...)
+        {
+            delete[] values;
+            throw;
+        }
+
+        count = elemtsRead;
+        return values;
+    }
+
+    //Asks every source at most once, exhausted ones are skipped without probing hasNext() first
+    virtual bool tryNext(T& element) override {
+        for (size_t tried = 0; tried < sourceCount; tried++) {
+            DataSource<T>* source = sources[currentSource];
+            currentSource = (currentSource + 1) % sourceCount;
+            if (source->tryNext(element))
+                return true;
+        }
+        return false;
+    }
+
+    virtual bool hasNext() const override {
+        for (size_t i = 0; i < sourceCount; i++) {
+            if (sources[i]->hasNext()) return true;
+        }
+        return false;
+    }
+
+    //Same order as tryNext(), every element comes from the current child's own async pull
+    virtual DataSourceTask<std::optional<T>> nextAsync(AsyncExecutor& resumeOn) override {
+        for (size_t tried = 0; tried < sourceCount; tried++) {
+            DataSource<T>* source = sources[currentSource];
+            currentSource = (currentSource + 1) % sourceCount;
+            std::optional<T> value = co_await source->nextAsync(resumeOn);
+            if (value)
+                co_return value;
+        }
+        co_return std::nullopt;
+    }
+
+    //The children take turns, so the batch is pulled one element at a time
+    virtual DataSourceTask<DataSourceBatch<T>> nextBatchAsync(size_t count, AsyncExecutor& resumeOn) override {
+        if (count == 0)
+            throw std::invalid_argument("Invalid count for next");
+
+        DataSourceBatch<T> batch{ new T[count], 0 };
+        try {
+            while (batch.count < count) {
+                std::optional<T> value = co_await nextAsync(resumeOn);
+                if (!value)
+                    break;
+                batch.values[batch.count++] = std::move(*value);
+            }
+        }
+        catch (...) {
+            delete[] batch.values;
+            throw;
+        }
+        co_return batch;
+    }
+
+    virtual bool reset() override {
+        for (size_t i = 0; i < sourceCount; i++) {
+            if (!sources[i]->reset()) return false;
+        }
+        currentSource = 0;
+        return true;
+    }
+
+    //What all the children took from their storage, so a wrapped alternate reports the bytes it pulled
+    virtual size_t bytesConsumed() const override {
+        size_t total = 0;
+        for (size_t i = 0; i < sourceCount; i++)
+            total += sources[i]->bytesConsumed();
+        return total;
+    }
+
+    //By child, children that can be split are split further to fill the requested parts
+    virtual DataSource<T>** split(size_t parts, size_t& partCount) const override {
+        partCount = 0;
+        if (sourceCount == 0 || parts == 0) {
+            return nullptr;
+        }
+
+        size_t partsPerChild = parts > sourceCount ? parts / sourceCount : 1;
+        std::vector<DataSource<T>*> collected;
+        try {
+            for (size_t i = 0; i < sourceCount; i++) {
+                size_t childParts = 0;
+                DataSource<T>** pieces = sources[i]->split(partsPerChild, childParts);
+                if (!pieces) {
+                    collected.push_back(nullptr); //reserve the slot before cloning so nothing leaks
+                    collected.back() = sources[i]->clone();
+                    continue;
+                }
+                for (size_t j = 0; j < childParts; j++) {
+                    try {
+                        collected.push_back(pieces[j]);
+                    }
+                    catch (...) {
+                        for (size_t k = j; k < childParts; k++)
+                            delete pieces[k];
+                        delete[] pieces;
+                        throw;
+                    }
+                }
+                delete[] pieces;
+            }
+        }
+        catch (...) {
+            for (size_t i = 0; i < collected.size(); i++)
+                delete collected[i];
+            throw;
+        }
+
+        DataSource<T>** result = nullptr;
+        try {
+            result = new DataSource<T>*[collected.size()];
+        }
+        catch (...) {
+            for (size_t i = 0; i < collected.size(); i++)
+                delete collected[i];
+            throw;
+        }
+        for (size_t i = 0; i < collected.size(); i++)
+            result[i] = collected[i];
+        partCount = collected.size();
+        return result;
+    }
+
+    virtual DataSource<T>* clone() const override
+    {
+        return new AlternateDataSource(*this);
+    }
+
+    virtual ~AlternateDataSource() override
+    {
+        for (size_t i = 0; i < this->sourceCount; i++)
+            delete this->sources[i];
+        delete[] this->sources;
+    }
+
+private:
+        DataSource<T>** sources;
+        size_t sourceCount;
+        size_t currentSource;
+
+};
+
+//Inline storage and constexpr members, so tables known at compile time need no heap and no startup work.
+//A constexpr instance is a ready made table, copy it to get a source that can be advanced.
+template<typename T, size_t N>
+class StaticArrayDataSource : public DataSource<T> {
+    static_assert(N > 0, "Size cant be 0");
+public:
+    constexpr StaticArrayDataSource(const T (&values)[N]) : data{}, current(0)
+    {
+        for (size_t i = 0; i < N; i++)
+            this->data[i] = values[i];
+    }
+
+    constexpr virtual T next() override {
+        if (N <= this->current)
+            throw std::invalid_argument("Index out of range");
+        return this->data[this->current++];
+    }
+
+    virtual T* next(size_t& count) override {
+        size_t available = N - current;
+        size_t actualCount = (count < available) ? count : available;
+
+        T* values = new T[actualCount];
+        try {
+            for (size_t i = 0; i < actualCount; i++) {
+                values[i] = this->data[current];
+                current++;
+            }
+        }
+        catch (...) {
+            delete[] values;
+            throw;
+        }
+
+        count = actualCount;
+        return values;
+    }
+
+    constexpr virtual bool tryNext(T& element) override {
+        if (N <= this->current)
+            return false;
+        element = this->data[this->current++];
+        return true;
+    }
+
+    constexpr virtual bool hasNext() const override {
+        return this->current < N;
+    }
+
+    constexpr virtual bool reset() override {
+        this->current = 0;
+        return true;
+    }
+
+    virtual DataSource<T>* clone() const override
+    {
+        return new StaticArrayDataSource(*this);
+    }
+
+    //By index range like ArrayDataSource, the parts are heap arrays with a copy of their slice
+    virtual DataSource<T>** split(size_t parts, size_t& partCount) const override {
+        partCount = 0;
+        if (parts == 0) {
+            return nullptr;
+        }
+
+        size_t remaining = N - this->current;
+        if (parts > remaining)
+            parts = remaining;
+
+        DataSource<T>** result = new DataSource<T>*[parts];
+        size_t begin = this->current;
+        for (size_t i = 0; i < parts; i++) {
+            size_t length = remaining / parts + (i < remaining % parts ? 1 : 0);
+            try {
+                result[i] = new ArrayDataSource<T>(this->data + begin, length);
+            }
+            catch (...) {
+                for (size_t j = 0; j < i; j++)
+                    delete result[j];
+                delete[] result;
+                partCount = 0;
+                throw;
+            }
+            begin += length;
+            partCount++;
+        }
+        return result;
+    }
+
+    constexpr size_t size() const {
+        return N;
+    }
+
+    constexpr const T& operator[](size_t index) const {
+        return this->data[index];
+    }
+
+    constexpr virtual ~StaticArrayDataSource() override = default; //spelled out so constexpr instances are allowed
+
+private:
+    T data[N];
+    size_t current;
+};
+
+//AlternateDataSource at compile time: takes the whole contents of every table in turn and skips
+//the ones that ran out, the result is a single table with all the elements
+template<typename T, size_t... Sizes>
+constexpr StaticArrayDataSource<T, (Sizes + ...)> interleave(const StaticArrayDataSource<T, Sizes>&... sources)
+{
+    const size_t total = (Sizes + ...);
+    const size_t sizes[] = { Sizes... };
+    const T* tables[] = { &sources[0]... };
+
+    T result[total]{};
+    size_t written = 0;
+    for (size_t round = 0; written < total; round++) {
+        for (size_t i = 0; i < sizeof...(Sizes); i++) {
+            if (round < sizes[i])
+                result[written++] = tables[i][round];
+        }
+    }
+    return StaticArrayDataSource<T, total>(result);
+}
+
+
+//  GeneratorDataSource
+template<typename T, typename Generator>
+class GeneratorDataSource : public DataSource<T> {
+public:
+    GeneratorDataSource(Generator generator) : generator(generator) {}
+
+    virtual T next() override {
+        return generator();
+    }
+
+    virtual bool tryNext(T& element) override {
+        element = generator();
+        return true;
+    }
+
+    virtual T* next(size_t& count) override {
+        T* newNext = new T[count];
+        try {
+            for (size_t i = 0; i < count; i++) {
+                newNext[i] = generator();
+            }
+        }
+        catch (...) {
+            delete[] newNext;
+            throw;
+        }
+        return newNext;
+    }
+
+    virtual bool hasNext() const override {
+        return true;
+    }
+
+    virtual bool reset() override {
+        return false;
+    }
+    virtual DataSource<T>* clone() const override
+    {
+        return new GeneratorDataSource(*this);
+    }
+
+    //The compiler will automatically generate a destructor
+
+private:
+    Generator generator;
+
+};
+
+
+//Generator written as a coroutine with co_yield, frames come from CoroutineFrameAllocator
+template<typename T>
+class CoroutineGenerator {
+public:
+    struct promise_type {
+        T value{};
+        std::exception_ptr exception;
+
+        CoroutineGenerator get_return_object() {
+            return CoroutineGenerator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() const noexcept {
+            return {};
+        }
+        std::suspend_always final_suspend() const noexcept {
+            return {};
+        }
+        std::suspend_always yield_value(T yielded) {
+            value = std::move(yielded);
+            return {};
+        }
+        void return_void() const noexcept {}
+        void unhandled_exception() {
+            exception = std::current_exception();
+        }
+        static void* operator new(size_t size) {
+            return CoroutineFrameAllocator::allocate(size);
+        }
+        static void operator delete(void* frame, size_t size) {
+            CoroutineFrameAllocator::deallocate(frame, size);
+        }
+    };
+
+    CoroutineGenerator(const CoroutineGenerator&) = delete;
+    CoroutineGenerator& operator=(const CoroutineGenerator&) = delete;
+
+    CoroutineGenerator(CoroutineGenerator&& other) noexcept : handle(other.handle) {
+        other.handle = nullptr;
+    }
+
+    CoroutineGenerator& operator=(CoroutineGenerator&& other) noexcept {
+        if (this != &other) {
+            std::swap(handle, other.handle);
+        }
+        return *this;
+    }
+
+    ~CoroutineGenerator() {
+        if (handle)
+            handle.destroy();
+    }
+
+    //Runs the body up to the next co_yield (or to the end)
+    void resume() {
+        handle.resume();
+        if (handle.promise().exception) {
+            std::exception_ptr exception = handle.promise().exception;
+            handle.promise().exception = nullptr;
+            std::rethrow_exception(exception);
+        }
+    }
+
+    bool done() const {
+        return handle.done();
+    }
+
+    T& value() {
+        return handle.promise().value;
+    }
+
+private:
+    explicit CoroutineGenerator(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+//Factory is called to start the coroutine, once at construction and again on every reset() and clone().
+//The body always runs one element ahead, so hasNext() is exact. An exception thrown by the body
+//while running ahead is kept and thrown by the pull after the element that was already produced.
+template<typename T, typename Factory>
+class CoroutineDataSource : public DataSource<T> {
+public:
+    CoroutineDataSource(Factory factory) : factory(factory), coroutine(this->factory()) {
+        pendingError = advance(coroutine);
+    }
+
+    //Like FileDataSource the copy starts from the beginning, a suspended frame cannot be copied
+    CoroutineDataSource(const CoroutineDataSource& other) : factory(other.factory), coroutine(factory()) {
+        pendingError = advance(coroutine);
+    }
+
+    CoroutineDataSource& operator=(const CoroutineDataSource& other) {
+        if (this != &other) {
+            CoroutineGenerator<T> restarted = other.factory();
+            std::exception_ptr error = advance(restarted);
+            factory = other.factory;
+            coroutine = std::move(restarted);
+            pendingError = error;
+        }
+        return *this;
+    }
+
+    virtual T next() override {
+        T value{};
+        if (!tryNext(value)) {
+            throw std::runtime_error("Coroutine has finished");
+        }
+        return value;
+    }
+
+    virtual T* next(size_t& count) override {
+        T* values = new T[count];
+        size_t elementsRead = 0;
+
+        try {
+            while (elementsRead < count && tryNext(values[elementsRead]))
+                elementsRead++;
+        }
+        catch (...) {
+            delete[] values;
+            throw;
+        }
+
+        count = elementsRead;
+        return values;
+    }
+
+    virtual bool tryNext(T& element) override {
+        if (pendingError) {
+            std::exception_ptr error = pendingError;
+            pendingError = nullptr;
+            std::rethrow_exception(error);
+        }
+        if (coroutine.done())
+            return false;
+        element = std::move(coroutine.value());
+        pendingError = advance(coroutine);
+        return true;
+    }
+
+    virtual bool hasNext() const override {
+        return !coroutine.done() || pendingError;
+    }
+
+    virtual bool reset() override {
+        CoroutineGenerator<T> restarted = factory();
+        std::exception_ptr error = advance(restarted);
+        coroutine = std::move(restarted);
+        pendingError = error;
+        return true;
+    }
+
+    virtual DataSource<T>* clone() const override
+    {
+        return new CoroutineDataSource(*this);
+    }
+
+    //The compiler will automatically generate a destructor
+
+private:
+    //Runs the body to its next element, an exception is returned instead of thrown
+    static std::exception_ptr advance(CoroutineGenerator<T>& generator) {
+        try {
+            generator.resume();
+        }
+        catch (...) {
+            return std::current_exception();
+        }
+        return nullptr;
+    }
+
+    Factory factory;
+    CoroutineGenerator<T> coroutine;
+    std::exception_ptr pendingError;
+};
+
+
+const size_t MaxInstrumentedSources = 64;
+const size_t LatencyBucketCount = 32; //bucket i counts calls that took less than 2^i nanoseconds (the last one is open ended)
+const size_t NoParentSource = static_cast<size_t>(-1);
+
+struct DataSourceStats {
+    std::string name;
+    size_t parent = NoParentSource; //index in the snapshot
+    std::vector<size_t> children;
+    bool measured = false; //false for a parent that only exists because of its children's names
+    unsigned long long elements{};
+    unsigned long long batches{};
+    unsigned long long bytes{};
+    unsigned long long exceptions{};
+    unsigned long long resets{};
+    unsigned long long calls{};
+    unsigned long long latency[LatencyBucketCount]{};
+
+    //Upper bound in nanoseconds of the given fraction of calls, read from the histogram
+    unsigned long long latencyPercentile(double fraction) const {
+        unsigned long long wanted = static_cast<unsigned long long>(fraction * calls);
+        unsigned long long seen = 0;
+        for (size_t i = 0; i < LatencyBucketCount; i++) {
+            seen += latency[i];
+            if (seen > wanted || (seen == calls && seen > 0))
+                return 1ull << i;
         }
+        return 0;
+    }
 
-        this->size = other.size;
-        this->current = other.current;
+    void add(const DataSourceStats& other) {
+        elements += other.elements;
+        batches += other.batches;
+        bytes += other.bytes;
+        exceptions += other.exceptions;
+        resets += other.resets;
+        calls += other.calls;
+        for (size_t i = 0; i < LatencyBucketCount; i++)
+            latency[i] += other.latency[i];
     }
-    ArrayDataSource(ArrayDataSource&& other) noexcept : data(nullptr), current(0), size(0)
-    {
-        *this = std::move(other);
+};
+
+//Process wide registry for instrumented sources. Every thread accumulates into its own block
+//of counters so recording never touches shared cache lines, snapshot() adds the blocks up.
+//Names are paths: "alternate/prime" is a child of "alternate", and the parent entry is created
+//even if nothing is registered under that exact name, so nested sources form a tree.
+class DataSourceMetrics {
+public:
+    static size_t registerSource(const char* name) {
+        if (!name || !*name) {
+            throw std::invalid_argument("Source name is empty");
+        }
+
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        size_t id = findOrAdd(reg, name);
+        reg.measured[id] = true;
+        return id;
     }
-    ArrayDataSource& operator=(const ArrayDataSource& other)
-    {
-        if (this != &other)
-        {
-            T* newData = new T[other.size];
 
-            for (size_t i = 0; i < other.size; i++)
-            {
-                try {
-                    newData[i] = other.data[i];
-                }
-                catch (...)
-                {
-                    delete[] newData;
-                    throw;
+    static void recordCall(size_t id, size_t elements, bool batch, size_t bytes, unsigned long long nanoseconds) {
+        Counters& counters = local().counters[id];
+        add(counters.elements, elements);
+        add(counters.bytes, bytes);
+        add(batch ? counters.batches : counters.calls, 1);
+        size_t bucket = 0;
+        while (nanoseconds > 0 && bucket < LatencyBucketCount - 1) {
+            nanoseconds >>= 1;
+            bucket++;
+        }
+        add(counters.latency[bucket], 1);
+    }
+
+    static void recordException(size_t id) {
+        add(local().counters[id].exceptions, 1);
+    }
+
+    static void recordReset(size_t id) {
+        add(local().counters[id].resets, 1);
+    }
+
+    static std::vector<DataSourceStats> snapshot() {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+
+        std::vector<DataSourceStats> result(reg.names.size());
+        for (size_t i = 0; i < result.size(); i++) {
+            result[i].name = reg.names[i];
+            result[i].parent = reg.parents[i];
+            result[i].measured = reg.measured[i];
+            if (reg.parents[i] != NoParentSource)
+                result[reg.parents[i]].children.push_back(i);
+            accumulate(result[i], reg.retired[i]);
+            for (size_t t = 0; t < reg.threads.size(); t++)
+                accumulate(result[i], reg.threads[t]->counters[i]);
+            result[i].calls += result[i].batches; //latency covers both kinds of calls
+        }
+        return result;
+    }
+
+    //Totals of an entry and everything below it. A measured source already counts what passed
+    //through it, so its own numbers are used as they are, otherwise the children are added up.
+    static DataSourceStats rollUp(const std::vector<DataSourceStats>& stats, size_t index) {
+        DataSourceStats total = stats[index];
+        if (!total.measured) {
+            for (size_t i = 0; i < stats[index].children.size(); i++)
+                total.add(rollUp(stats, stats[index].children[i]));
+        }
+        return total;
+    }
+
+    //The tree of sources, parents show their roll-up
+    static void print(std::ostream& out) {
+        std::vector<DataSourceStats> stats = snapshot();
+        for (size_t i = 0; i < stats.size(); i++) {
+            if (stats[i].parent == NoParentSource)
+                printTree(out, stats, i, 0);
+        }
+    }
+
+private:
+    struct Counters {
+        std::atomic<unsigned long long> elements{};
+        std::atomic<unsigned long long> batches{};
+        std::atomic<unsigned long long> bytes{};
+        std::atomic<unsigned long long> exceptions{};
+        std::atomic<unsigned long long> resets{};
+        std::atomic<unsigned long long> calls{};
+        std::atomic<unsigned long long> latency[LatencyBucketCount]{};
+    };
+
+    struct ThreadBlock;
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<std::string> names;
+        std::vector<size_t> parents;
+        std::vector<bool> measured;
+        std::vector<ThreadBlock*> threads;
+        Counters retired[MaxInstrumentedSources]; //totals of threads that already finished
+    };
+
+    struct ThreadBlock {
+        Counters counters[MaxInstrumentedSources];
+
+        ThreadBlock() {
+            Registry& reg = registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            reg.threads.push_back(this);
+        }
+
+        ~ThreadBlock() {
+            Registry& reg = registry();
+            std::lock_guard<std::mutex> lock(reg.mutex);
+            for (size_t i = 0; i < MaxInstrumentedSources; i++)
+                merge(reg.retired[i], counters[i]);
+            for (size_t i = 0; i < reg.threads.size(); i++) {
+                if (reg.threads[i] == this) {
+                    reg.threads.erase(reg.threads.begin() + i);
+                    break;
                 }
             }
+        }
+    };
 
-            delete[] this->data;
-            this->data = newData;
-            this->size = other.size;
-            this->current = other.current;
+    static Registry& registry() {
+        static Registry instance;
+        return instance;
+    }
+
+    static size_t findOrAdd(Registry& reg, const std::string& name) {
+        for (size_t i = 0; i < reg.names.size(); i++) {
+            if (reg.names[i] == name)
+                return i; //same name means same entry, so recreated sources keep adding up
+        }
+
+        size_t parent = NoParentSource;
+        size_t separator = name.rfind('/');
+        if (separator != std::string::npos && separator > 0)
+            parent = findOrAdd(reg, name.substr(0, separator));
+
+        if (reg.names.size() == MaxInstrumentedSources) {
+            throw std::length_error("Too many instrumented sources");
+        }
+        reg.names.push_back(name);
+        reg.parents.push_back(parent);
+        reg.measured.push_back(false);
+        return reg.names.size() - 1;
+    }
+
+    static void printTree(std::ostream& out, const std::vector<DataSourceStats>& stats, size_t index, size_t depth) {
+        DataSourceStats total = rollUp(stats, index);
+        out << std::string(depth * 2, ' ') << total.name
+            << ": elements=" << total.elements
+            << " batches=" << total.batches
+            << " bytes=" << total.bytes
+            << " exceptions=" << total.exceptions
+            << " resets=" << total.resets
+            << " p50<=" << total.latencyPercentile(0.5) << "ns"
+            << " p99<=" << total.latencyPercentile(0.99) << "ns" << std::endl;
+        for (size_t i = 0; i < stats[index].children.size(); i++)
+            printTree(out, stats, stats[index].children[i], depth + 1);
+    }
+
+    static ThreadBlock& local() {
+        thread_local ThreadBlock block;
+        return block;
+    }
+
+    //Only the owning thread writes its block, a relaxed load + store is enough and avoids a locked add
+    static void add(std::atomic<unsigned long long>& counter, unsigned long long value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    static void merge(Counters& to, const Counters& from) {
+        to.elements.fetch_add(from.elements.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.batches.fetch_add(from.batches.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.bytes.fetch_add(from.bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.exceptions.fetch_add(from.exceptions.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.resets.fetch_add(from.resets.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.calls.fetch_add(from.calls.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        for (size_t i = 0; i < LatencyBucketCount; i++)
+            to.latency[i].fetch_add(from.latency[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    static void accumulate(DataSourceStats& to, const Counters& from) {
+        to.elements += from.elements.load(std::memory_order_relaxed);
+        to.batches += from.batches.load(std::memory_order_relaxed);
+        to.bytes += from.bytes.load(std::memory_order_relaxed);
+        to.exceptions += from.exceptions.load(std::memory_order_relaxed);
+        to.resets += from.resets.load(std::memory_order_relaxed);
+        to.calls += from.calls.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < LatencyBucketCount; i++)
+            to.latency[i] += from.latency[i].load(std::memory_order_relaxed);
+    }
+};
+
+//Opt-in decorator, sources that are not wrapped pay nothing. To see the children of an
+//AlternateDataSource wrap them before passing them in as "parent/child", the clones report under
+//the same name and the parent rolls them up. The parent itself may be wrapped too.
+template<typename T>
+class InstrumentedDataSource : public DataSource<T> {
+public:
+    InstrumentedDataSource(const DataSource<T>* source, const char* name)
+        : source(nullptr), id(DataSourceMetrics::registerSource(name))
+    {
+        if (!source)
+        {
+            throw std::invalid_argument("Source is nullptr");
         }
+        this->source = source->clone();
+    }
+
+    InstrumentedDataSource(const InstrumentedDataSource& other)
+        : source(other.source->clone()), id(other.id)
+    {
+    }
+
+    InstrumentedDataSource(InstrumentedDataSource&& other) noexcept
+        : source(other.source), id(other.id)
+    {
+        other.source = nullptr;
+    }
 
+    InstrumentedDataSource& operator=(const InstrumentedDataSource& other)
+    {
+        if (this != &other) {
+            DataSource<T>* newSource = other.source->clone();
+            delete this->source;
+            this->source = newSource;
+            this->id = other.id;
+        }
         return *this;
     }
-    ArrayDataSource& operator=(ArrayDataSource&& other) noexcept
+
+    InstrumentedDataSource& operator=(InstrumentedDataSource&& other) noexcept
     {
         if (this != &other) {
-            std::swap(this->data, other.data);
-            std::swap(this->size, other.size);
-            std::swap(this->current, other.current);
+            std::swap(this->source, other.source);
+            std::swap(this->id, other.id);
         }
         return *this;
     }
+
     virtual T next() override {
-        if (this->size <= this->current)
-            throw std::invalid_argument("Index out of range");
-        return this->data[this->current++];
+        size_t bytesBefore = source->bytesConsumed();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        try {
+            T value = source->next();
+            record(start, bytesBefore, 1, false);
+            return value;
+        }
+        catch (...) {
+            DataSourceMetrics::recordException(id);
+            throw;
+        }
     }
 
     virtual T* next(size_t& count) override {
-        size_t available = size - current;
-        size_t actualCount = (count < available) ? count : available;
+        size_t bytesBefore = source->bytesConsumed();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        try {
+            T* values = source->next(count);
+            record(start, bytesBefore, count, true);
+            return values;
+        }
+        catch (...) {
+            DataSourceMetrics::recordException(id);
+            throw;
+        }
+    }
 
-        T* values = nullptr;
+    virtual bool tryNext(T& element) override {
+        size_t bytesBefore = source->bytesConsumed();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
         try {
-            values = new T[actualCount];
+            bool produced = source->tryNext(element);
+            record(start, bytesBefore, produced ? 1 : 0, false);
+            return produced;
+        }
+        catch (...) {
+            DataSourceMetrics::recordException(id);
+            throw;
+        }
+    }
 
-            for (size_t i = 0; i < actualCount; i++) {
-                values[i] = this->data[current];
-                current++;
-            }
-            count = actualCount;
+    virtual bool hasNext() const override {
+        return source->hasNext();
+    }
 
+    //Forwarded so the wrapped source still reads off the caller's thread, the latency includes the hops
+    virtual DataSourceTask<std::optional<T>> nextAsync(AsyncExecutor& resumeOn) override {
+        size_t bytesBefore = source->bytesConsumed();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::optional<T> value;
+        try {
+            value = co_await source->nextAsync(resumeOn);
         }
         catch (...) {
-            delete[] values;  
-            throw; 
+            DataSourceMetrics::recordException(id);
+            throw;
         }
+        record(start, bytesBefore, value ? 1 : 0, false);
+        co_return value;
+    }
 
-        return values;
+    virtual DataSourceTask<DataSourceBatch<T>> nextBatchAsync(size_t count, AsyncExecutor& resumeOn) override {
+        size_t bytesBefore = source->bytesConsumed();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        DataSourceBatch<T> batch{ nullptr, 0 };
+        try {
+            batch = co_await source->nextBatchAsync(count, resumeOn);
+        }
+        catch (...) {
+            DataSourceMetrics::recordException(id);
+            throw;
+        }
+        record(start, bytesBefore, batch.count, true);
+        co_return batch;
     }
 
+    virtual bool reset() override {
+        DataSourceMetrics::recordReset(id);
+        return source->reset();
+    }
 
-    virtual bool hasNext() const override {
-        return this->current < this->size;
+    virtual DataSource<T>* clone() const override
+    {
+        return new InstrumentedDataSource(*this);
     }
 
-    virtual bool reset() override {
-        this->current = 0;
-        return true;
+    virtual size_t bytesConsumed() const override {
+        return source->bytesConsumed();
     }
 
-    ArrayDataSource<T>& operator+=(const T& element) {
-        T* newData = new T[this->size + 1];
-        for (size_t i = 0; i < this->size; i++) {
+    //The parts keep reporting under the same name, from whichever thread reads them
+    virtual DataSource<T>** split(size_t parts, size_t& partCount) const override {
+        DataSource<T>** pieces = source->split(parts, partCount);
+        if (!pieces) {
+            return nullptr;
+        }
+
+        for (size_t i = 0; i < partCount; i++) {
             try {
-                newData[i] = this->data[i];
+                pieces[i] = new InstrumentedDataSource(pieces[i], id);
             }
             catch (...) {
-                delete[] newData;
+                for (size_t j = 0; j < partCount; j++)
+                    delete pieces[j]; //wrapped or not, every slot still owns exactly one source
+                delete[] pieces;
+                partCount = 0;
                 throw;
             }
         }
-        try {
-            newData[this->size] = element;
-        }
-        catch (...)
+        return pieces;
+    }
+
+    virtual ~InstrumentedDataSource() override
+    {
+        delete source;
+    }
+
+private:
+    //Takes ownership of an already cloned source
+    InstrumentedDataSource(DataSource<T>* owned, size_t id) : source(owned), id(id) {}
+
+    void record(std::chrono::steady_clock::time_point start, size_t bytesBefore, size_t elements, bool batch) {
+        std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+        size_t bytesAfter = source->bytesConsumed();
+        DataSourceMetrics::recordCall(id, elements, batch,
+            bytesAfter > bytesBefore ? bytesAfter - bytesBefore : 0, //a reset in between moves the position back
+            static_cast<unsigned long long>(elapsed.count()));
+    }
+
+    DataSource<T>* source;
+    size_t id;
+};
+
+const size_t DefaultCacheMemoryBudget = 64 * 1024 * 1024; //bytes kept in memory before chunks go to a temp file
+
+//std::fseek takes a long, which is 32 bits on Windows, so large spill files need the 64 bit variants
+inline int seekFileTo(std::FILE* file, unsigned long long offset) {
+#ifdef _WIN32
+    return _fseeki64(file, static_cast<__int64>(offset), SEEK_SET);
+#else
+    return fseeko(file, static_cast<off_t>(offset), SEEK_SET);
+#endif
+}
+
+//Records what the wrapped source produced so reset() replays it from the cache instead of asking
+//the source again, which makes generators resettable. Clones share the recorded prefix and the
+//wrapped source, each one keeps its own position. Trivially copyable elements beyond the memory
+//budget are spilled to a temporary file, everything else stays in memory.
+//Replay copies a chunk span per lock into the cursor's own buffer and serves the elements from there.
+template<typename T>
+class CachedDataSource : public DataSource<T> {
+public:
+    CachedDataSource(const DataSource<T>* source, size_t memoryBudget = DefaultCacheMemoryBudget)
+        : position(0), bufferedBegin(0), bufferedEnd(0)
+    {
+        if (!source)
         {
-            delete[] newData;
-            throw;
+            throw std::invalid_argument("Source is nullptr");
+        }
+        store = std::make_shared<Store>(source->clone(), memoryBudget);
+    }
+
+    CachedDataSource(const CachedDataSource& other)
+        : store(other.store), position(other.position), bufferedBegin(0), bufferedEnd(0)
+    {
+    }
+
+    CachedDataSource(CachedDataSource&& other) noexcept
+        : store(std::move(other.store)), position(other.position),
+        buffer(std::move(other.buffer)), bufferedBegin(other.bufferedBegin), bufferedEnd(other.bufferedEnd)
+    {
+        other.position = 0;
+        other.bufferedBegin = 0;
+        other.bufferedEnd = 0;
+    }
+
+    CachedDataSource& operator=(const CachedDataSource& other)
+    {
+        if (this != &other) {
+            this->store = other.store;
+            this->position = other.position;
+            this->bufferedBegin = 0;
+            this->bufferedEnd = 0;
         }
-        delete[] this->data;
-        this->data = newData;
-        this->size++;
         return *this;
     }
 
-    ArrayDataSource<T>& operator--() {
-        if (this->current > 0) {
-            --this->current;
+    CachedDataSource& operator=(CachedDataSource&& other) noexcept
+    {
+        if (this != &other) {
+            std::swap(this->store, other.store);
+            std::swap(this->position, other.position);
+            std::swap(this->buffer, other.buffer);
+            std::swap(this->bufferedBegin, other.bufferedBegin);
+            std::swap(this->bufferedEnd, other.bufferedEnd);
         }
         return *this;
     }
 
-    ArrayDataSource<T>& operator--(int) {
-        ArrayDataSource<T>& temp = *this;
-        --(*this);
-        return temp;
+    virtual T next() override {
+        T value{};
+        if (!tryNext(value)) {
+            throw std::runtime_error("Cached source is exhausted");
+        }
+        return value;
     }
-    virtual ~ArrayDataSource() override
-    {
-        delete[] this->data;
+
+    virtual T* next(size_t& count) override {
+        T* values = new T[count];
+        try {
+            count = read(values, count);
+        }
+        catch (...) {
+            delete[] values;
+            throw;
+        }
+        return values;
+    }
+
+    virtual bool tryNext(T& element) override {
+        return read(&element, 1) == 1;
+    }
+
+    virtual bool hasNext() const override {
+        if (position >= bufferedBegin && position < bufferedEnd)
+            return true;
+        std::lock_guard<std::mutex> lock(store->mutex);
+        return position < store->size || store->source->hasNext();
+    }
+
+    //Replay completes inline. New elements come from the shared source under the store lock, which
+    //cannot be held across an await, so that pull runs on the BlockingIoExecutor thread instead
+    virtual DataSourceTask<std::optional<T>> nextAsync(AsyncExecutor& resumeOn) override {
+        bool pulls = !isRecorded(1);
+        std::optional<T> value;
+        std::exception_ptr error;
+
+        if (pulls)
+            co_await BlockingIoExecutor::instance().schedule();
+        try {
+            T element{};
+            if (read(&element, 1) == 1)
+                value = std::move(element);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        if (pulls)
+            co_await resumeOn.schedule();
+
+        if (error)
+            std::rethrow_exception(error);
+        co_return value;
+    }
+
+    virtual DataSourceTask<DataSourceBatch<T>> nextBatchAsync(size_t count, AsyncExecutor& resumeOn) override {
+        bool pulls = !isRecorded(count);
+        DataSourceBatch<T> batch{ nullptr, count };
+        std::exception_ptr error;
+
+        if (pulls)
+            co_await BlockingIoExecutor::instance().schedule();
+        try {
+            batch.values = this->next(batch.count);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        if (pulls)
+            co_await resumeOn.schedule();
+
+        if (error)
+            std::rethrow_exception(error);
+        co_return batch;
+    }
+
+    //The buffer stays valid, recorded elements never change
+    virtual bool reset() override {
+        this->position = 0;
+        return true;
     }
 
     virtual DataSource<T>* clone() const override
     {
-        return new ArrayDataSource(*this);
+        return new CachedDataSource(*this);
     }
 
-private:
-    T* data;
-    size_t current;
-    size_t size;
-};
+    //Bytes the shared wrapped source took from its storage, replaying from the cache adds nothing
+    virtual size_t bytesConsumed() const override {
+        std::lock_guard<std::mutex> lock(store->mutex);
+        return store->source->bytesConsumed();
+    }
 
-template<typename T>
-ArrayDataSource<T> operator+(const ArrayDataSource<T>& arr, const T& element) {
-    ArrayDataSource<T> result(arr);
-    result += element;
-    return result;
-}
+    //Number of elements recorded so far, shared by all clones
+    size_t cachedCount() const {
+        std::lock_guard<std::mutex> lock(store->mutex);
+        return store->size;
+    }
 
-template<typename T>
-class AlternateDataSource : public DataSource<T> {
-public:
-    AlternateDataSource(DataSource<T>** sources, size_t sourceCount)
-        :sourceCount(sourceCount), currentSource(0)
-    {
-        if (!sources)
-        {
-            throw std::invalid_argument("Sources is nullptr");
-        }
+    //The compiler will automatically generate a destructor
 
-        if (sourceCount == 0)
+private:
+    static const size_t ChunkSize = 1024;
+
+    struct Store {
+        Store(DataSource<T>* source, size_t memoryBudget)
+            : source(source), size(0), memoryBudget(memoryBudget), spillFile(nullptr), spilledChunks(0)
         {
-            throw std::invalid_argument("Soruce count is 0");
         }
-        this->sources = new DataSource<T>*[sourceCount];
 
-        for (size_t i = 0; i < sourceCount; i++) {
-            try {
-                this->sources[i] = sources[i]->clone();
-            }
-            catch (...) {
-                for (size_t j = 0; j < i; j++)
-                    delete this->sources[j];
-                delete[] this->sources;
-                throw;
-            }
+        ~Store() {
+            delete source;
+            if (spillFile)
+                std::fclose(spillFile);
         }
+
+        std::mutex mutex;
+        DataSource<T>* source;
+        std::vector<std::unique_ptr<T[]>> chunks; //empty pointer once the chunk is spilled
+        size_t size;
+        size_t memoryBudget;
+        std::FILE* spillFile; //chunk i lives at offset i * ChunkSize * sizeof(T)
+        size_t spilledChunks; //always a prefix, the oldest chunks leave memory first
+    };
+
+    //True when the next count elements are already in the cache, reading them does not touch the source
+    bool isRecorded(size_t count) const {
+        if (position >= bufferedBegin && position + count <= bufferedEnd)
+            return true;
+        std::lock_guard<std::mutex> lock(store->mutex);
+        return position + count <= store->size;
     }
 
-    AlternateDataSource(const AlternateDataSource& other)
-        : sources(nullptr), sourceCount(other.sourceCount), currentSource(other.currentSource)
-    {
-        this->sources = new DataSource<T>*[other.sourceCount];
+    //Elements already in this cursor's buffer are copied without the lock,
+    //otherwise the next span is fetched under it
+    size_t read(T* out, size_t count) {
+        size_t produced = 0;
 
-        for (size_t i = 0; i < other.sourceCount; i++) {
-            try {
-                this->sources[i] = other.sources[i]->clone();
-            }
-            catch (...) {
-                for (size_t j = 0; j < i; j++)
-                    delete this->sources[j];
-                delete[] this->sources;
-                throw;
+        while (produced < count) {
+            if (position < bufferedBegin || position >= bufferedEnd) {
+                std::lock_guard<std::mutex> lock(store->mutex);
+                if (!fill(count - produced))
+                    break;
             }
+
+            size_t taken = std::min(bufferedEnd - position, count - produced);
+            const T* source = buffer.get() + (position - bufferedBegin);
+            for (size_t i = 0; i < taken; i++)
+                out[produced + i] = source[i];
+            produced += taken;
+            position += taken;
         }
+        return produced;
     }
 
-    AlternateDataSource(AlternateDataSource&& other) noexcept
-        : sources(other.sources), sourceCount(other.sourceCount), currentSource(other.currentSource)
-    {
-        other.sources = nullptr;
-        other.sourceCount = 0;
-        other.currentSource = 0;
+    //Called with the store locked. New elements are pulled from the wrapped source only at the end
+    //of the cache, at most wanted of them. Copies the recorded rest of position's chunk into the buffer
+    bool fill(size_t wanted) {
+        if (position == store->size) {
+            for (size_t i = 0; i < wanted && append(); i++) {}
+            if (position == store->size)
+                return false;
+        }
+        if (!buffer)
+            buffer.reset(new T[ChunkSize]);
+
+        size_t chunk = position / ChunkSize;
+        size_t offset = position % ChunkSize;
+        size_t available = std::min(store->size - position, ChunkSize - offset);
+
+        if (store->chunks[chunk]) {
+            const T* source = store->chunks[chunk].get() + offset;
+            for (size_t i = 0; i < available; i++)
+                buffer[i] = source[i];
+        }
+        else {
+            loadSpilled(chunk, offset, available);
+        }
+        bufferedBegin = position;
+        bufferedEnd = position + available;
+        return true;
     }
 
-    AlternateDataSource& operator=(const AlternateDataSource& other)
-    {
-        if (this != &other) {
-            DataSource<T>** newData = new DataSource<T>*[other.sourceCount];
+    bool append() {
+        T value{};
+        if (!store->source->tryNext(value))
+            return false;
 
-            for (size_t i = 0; i < other.sourceCount; i++) {
-                try {
-                    newData[i] = other.sources[i]->clone();
+        if (store->size % ChunkSize == 0) {
+            store->chunks.push_back(std::unique_ptr<T[]>(new T[ChunkSize]));
+            spillIfOverBudget();
+        }
+        store->chunks[store->size / ChunkSize][store->size % ChunkSize] = value;
+        store->size++;
+        return true;
+    }
+
+    void spillIfOverBudget() {
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            size_t chunkBytes = ChunkSize * sizeof(T);
+            //the last chunk is still being filled, only full ones leave memory
+            while ((store->chunks.size() - store->spilledChunks) * chunkBytes > store->memoryBudget
+                && store->spilledChunks + 1 < store->chunks.size()) {
+                if (!store->spillFile) {
+                    store->spillFile = std::tmpfile();
+                    if (!store->spillFile)
+                        return; //no temp file available, keep everything in memory
                 }
-                catch (...) {
-                    for (size_t j = 0; j < i; j++)
-                        delete newData[j];
-                    delete[] newData;
-                    throw;
+
+                size_t chunk = store->spilledChunks;
+                if (seekFileTo(store->spillFile, static_cast<unsigned long long>(chunk) * chunkBytes) != 0
+                    || std::fwrite(store->chunks[chunk].get(), sizeof(T), ChunkSize, store->spillFile) != ChunkSize) {
+                    throw std::runtime_error("Failed to write cache spill file");
                 }
+                store->chunks[chunk].reset();
+                store->spilledChunks++;
             }
+        }
+    }
 
-            for (size_t i = 0; i < this->sourceCount; i++) {
-                delete this->sources[i];
+    //Spilled chunks are read back into this cursor's own buffer, clones never fight over it
+    void loadSpilled(size_t chunk, size_t offset, size_t count) {
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            unsigned long long begin = (static_cast<unsigned long long>(chunk) * ChunkSize + offset) * sizeof(T);
+            if (seekFileTo(store->spillFile, begin) != 0
+                || std::fread(buffer.get(), sizeof(T), count, store->spillFile) != count) {
+                throw std::runtime_error("Failed to read cache spill file");
             }
-            delete[] this->sources;
-
-            this->sources = newData;
-            this->sourceCount = other.sourceCount;
-            this->currentSource = other.currentSource;
         }
-
-        return *this;
+        else {
+            (void)chunk;
+            (void)offset;
+            (void)count;
+            throw std::logic_error("Only trivially copyable elements are spilled");
+        }
     }
 
-    AlternateDataSource& operator=(AlternateDataSource&& other) noexcept
+    std::shared_ptr<Store> store;
+    size_t position;
+    std::unique_ptr<T[]> buffer;
+    size_t bufferedBegin; //buffer holds the elements at positions [bufferedBegin, bufferedEnd)
+    size_t bufferedEnd;
+};
+
+//Every worker owns a deque, it pops its own work from the back and steals from the front of the others
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(size_t threadCount = std::thread::hardware_concurrency())
+        : pending(0), nextQueue(0), stopping(false)
     {
-        if (this != &other) {
-            std::swap(this->sources, other.sources);
-            std::swap(this->sourceCount, other.sourceCount);
-            std::swap(this->currentSource, other.currentSource);
+        if (threadCount == 0)
+            threadCount = 1;
+
+        for (size_t i = 0; i < threadCount; i++)
+            queues.push_back(std::unique_ptr<Queue>(new Queue()));
+        try {
+            for (size_t i = 0; i < threadCount; i++)
+                threads.push_back(std::thread([this, i]() { run(i); }));
+        }
+        catch (...) {
+            stop();
+            throw;
         }
-        return *this;
     }
 
-    virtual T next() override {
-        if (sourceCount == 0) return T{};
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
 
-        T value;
-        size_t start = currentSource;
+    ~WorkStealingPool() {
+        stop();
+    }
 
-        do {
-            if (*sources[currentSource]) {
-                value = sources[currentSource]->next();
-                currentSource = (currentSource + 1) % sourceCount;
-                return value;
-            }
-            currentSource = (currentSource + 1) % sourceCount;
-        } while (currentSource != start);
+    //From a worker of this pool the task goes to that worker's own deque, otherwise round robin
+    void submit(std::function<void()> task) {
+        size_t index = (currentPool() == this) ? currentWorker() : nextQueue.fetch_add(1) % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            pending++;
+        }
+        wake.notify_one();
+    }
 
-        return T{};
+    //Runs one queued task on the calling thread, lets a waiting thread help instead of blocking
+    bool runOne() {
+        std::function<void()> task;
+        if (!take(currentPool() == this ? currentWorker() : 0, task))
+            return false;
+        task();
+        return true;
     }
 
-    virtual T* next(size_t& count) override {
-        if (count == 0)
-            throw std::invalid_argument("Invalid count for next");
+    size_t size() const {
+        return queues.size();
+    }
 
-        T* values = new T[count];
-        size_t elemtsRead{};
-        for (size_t i = 0; i < count; i++) {
-            if (this->hasNext())
-            {
-                try {
-                    values[i] = this->next();
-                    elemtsRead++;
-                }
-                catch (...)
-                {
-                    delete[] values;
-                    throw;
-                }
-            }
-            else
-            {
-                count = elemtsRead;
-                return values;
-                
-            }
-        }
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    static WorkStealingPool*& currentPool() {
+        thread_local WorkStealingPool* pool = nullptr;
+        return pool;
+    }
 
-        return values;
+    static size_t& currentWorker() {
+        thread_local size_t worker = 0;
+        return worker;
     }
 
-    virtual bool hasNext() const override {
-        for (size_t i = 0; i < sourceCount; i++) {
-            if (sources[i]->hasNext()) return true;
+    bool take(size_t self, std::function<void()>& task) {
+        for (size_t i = 0; i < queues.size(); i++) {
+            Queue& queue = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+                continue;
+
+            if (i == 0) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            std::lock_guard<std::mutex> sleepLock(sleepMutex);
+            pending--;
+            return true;
         }
         return false;
     }
 
-    virtual bool reset() override {
-        for (size_t i = 0; i < sourceCount; i++) {
-            if (!sources[i]->reset()) return false;
-        }
-        currentSource = 0;
-        return true;
-    }
+    void run(size_t self) {
+        currentPool() = this;
+        currentWorker() = self;
+        while (true) {
+            std::function<void()> task;
+            if (take(self, task)) {
+                task();
+                continue;
+            }
 
-    virtual DataSource<T>* clone() const override
-    {
-        return new AlternateDataSource(*this);
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this]() { return stopping || pending > 0; });
+            if (stopping && pending == 0)
+                return;
+        }
     }
 
-    virtual ~AlternateDataSource() override
-    {
-        for (size_t i = 0; i < this->sourceCount; i++)
-            delete this->sources[i];
-        delete[] this->sources;
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+        threads.clear();
     }
 
-private:
-        DataSource<T>** sources;
-        size_t sourceCount;
-        size_t currentSource;
-
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    size_t pending; //queued but not yet taken, guarded by sleepMutex
+    std::atomic<size_t> nextQueue;
+    bool stopping;
 };
 
-//  GeneratorDataSource
-template<typename T, typename Generator>
-class GeneratorDataSource : public DataSource<T> {
-public:
-    GeneratorDataSource(Generator generator) : generator(generator) {}
-
-    virtual T next() override {
-        return generator();
+template<typename T, typename Result, typename Accumulate>
+void reduceSequential(DataSource<T>& source, Result& partial, Accumulate& accumulate) {
+    const size_t BatchSize = 1024;
+    while (true) {
+        size_t count = BatchSize;
+        T* batch = source.next(count);
+        try {
+            for (size_t i = 0; i < count; i++)
+                accumulate(partial, batch[i]);
+        }
+        catch (...) {
+            delete[] batch;
+            throw;
+        }
+        delete[] batch;
+        if (count == 0)
+            return;
     }
+}
 
-    virtual T* next(size_t& count) override {
-        T* newNext = new T[count];
+//Folds every remaining element of a finite source with accumulate(Result&, const T&) and merges the
+//partial results with combine(Result&, const Result&). Sources that cannot be split are folded on the
+//calling thread. The parts are read in no particular order, so combine has to be associative and
+//commutative. The source itself is not advanced. Every part folds with its own copy of accumulate.
+template<typename T, typename Result, typename Accumulate, typename Combine>
+Result parallelReduce(const DataSource<T>& source, const Result& identity,
+    Accumulate accumulate, Combine combine, WorkStealingPool& pool)
+{
+    size_t partCount = 0;
+    DataSource<T>** parts = source.split(pool.size() * 4, partCount); //more parts than threads leaves room for stealing
+    if (!parts) {
+        DataSource<T>* copy = source.clone();
+        Result result = identity;
         try {
-            for (size_t i = 0; i < count; i++) {
-                newNext[i] = generator();
-            }
+            reduceSequential(*copy, result, accumulate);
         }
         catch (...) {
-            delete[] newNext;
+            delete copy;
             throw;
         }
-        return newNext;
+        delete copy;
+        return result;
     }
 
-    virtual bool hasNext() const override {
-        return true;
+    //one per part on its own cache line, a plain vector<Result> would pack bools into shared words
+    struct alignas(64) Partial {
+        Result value;
+        std::exception_ptr error;
+    };
+    std::vector<Partial> partials;
+    try {
+        partials.assign(partCount, Partial{ identity, nullptr });
+    }
+    catch (...) {
+        for (size_t i = 0; i < partCount; i++)
+            delete parts[i];
+        delete[] parts;
+        throw;
     }
 
-    virtual bool reset() override {
-        return false;
+    std::mutex doneMutex;
+    std::condition_variable allDone;
+    size_t remaining = 0; //guarded by doneMutex, the last part to finish signals allDone
+    std::exception_ptr submitError;
+    for (size_t i = 0; i < partCount; i++) {
+        {
+            std::lock_guard<std::mutex> lock(doneMutex);
+            remaining++;
+        }
+        try {
+            pool.submit([&, i, accumulate]() mutable {
+                try {
+                    reduceSequential(*parts[i], partials[i].value, accumulate);
+                }
+                catch (...) {
+                    partials[i].error = std::current_exception();
+                }
+                std::lock_guard<std::mutex> lock(doneMutex);
+                if (--remaining == 0)
+                    allDone.notify_all();
+            });
+        }
+        catch (...) {
+            //the parts already queued still have to finish before anything is freed
+            std::lock_guard<std::mutex> lock(doneMutex);
+            remaining--;
+            submitError = std::current_exception();
+            break;
+        }
     }
-    virtual DataSource<T>* clone() const override
+
+    //help with the queued parts first, this also keeps a call from inside the pool from deadlocking.
+    //Once nothing is left to take the unfinished parts are running on workers, so just wait for them
+    while (pool.runOne()) {}
     {
-        return new GeneratorDataSource(*this);
+        std::unique_lock<std::mutex> lock(doneMutex);
+        allDone.wait(lock, [&remaining]() { return remaining == 0; });
     }
 
-    //The compiler will automatically generate a destructor
+    for (size_t i = 0; i < partCount; i++)
+        delete parts[i];
+    delete[] parts;
 
-private:
-    Generator generator;
+    if (submitError)
+        std::rethrow_exception(submitError);
+    for (size_t i = 0; i < partCount; i++) {
+        if (partials[i].error)
+            std::rethrow_exception(partials[i].error);
+    }
 
-};
+    Result result = identity;
+    for (size_t i = 0; i < partCount; i++)
+        combine(result, partials[i].value);
+    return result;
+}
 
 
 char* generateRandomString() {
@@ -660,46 +3263,97 @@ char* generateRandomString() {
 }
 
 
+constexpr bool isPrimeNumber(size_t number) {
+    if (number <= 1) return false;
+    if (number <= 3) return true;
+    if (number % 2 == 0 || number % 3 == 0) return false;
+
+    for (size_t i = 5; i * i <= number; i += 6) { 
+        if (number % i == 0 || number % (i + 2) == 0) return false; // All primes greater than 3 can be written in the form 6k +- 1
+    }                                                               // so it is more efficient than checking every number up to sqrt(number)
+    return true;
+}
+
 class PrimeGenerator
 {
 public:
     size_t operator()() {
-        while (!isPrime(current)) {
+        while (!isPrimeNumber(current)) {
             ++current;
         }
         return current++;
     }
 private:
-    bool isPrime(size_t number) {
-        if (number <= 1) return false;
-        if (number <= 3) return true;
-        if (number % 2 == 0 || number % 3 == 0) return false;
-
-        for (int i = 5; i * i <= number; i += 6) { 
-            if (number % i == 0 || number % (i + 2) == 0) return false; // All primes greater than 3 can be written in the form 6k +- 1
-        }                                                               // so it is more efficient than checking every number up to sqrt(number)
-        return true;
-    }
     size_t current{ 2 };
 };
 
+//The first N Fibonacci numbers, an overflow of a signed T stops the compilation
+template<typename T, size_t N>
+constexpr StaticArrayDataSource<T, N> staticFibonacci() {
+    T fibonacci[N]{};
+    T previous = 0;
+    T current = 1;
+
+    for (size_t i = 0; i < N; i++) {
+        fibonacci[i] = previous;
+        if (i + 1 < N) {
+            T following = previous + current;
+            previous = current;
+            current = following;
+        }
+    }
+    return StaticArrayDataSource<T, N>(fibonacci);
+}
+
+constexpr size_t countPrimesUpTo(size_t bound) {
+    size_t count = 0;
+    for (size_t number = 2; number <= bound; number++) {
+        if (isPrimeNumber(number))
+            count++;
+    }
+    return count;
+}
+
+//All primes up to and including Bound
+template<typename T, size_t Bound>
+constexpr StaticArrayDataSource<T, countPrimesUpTo(Bound)> staticPrimes() {
+    T primes[countPrimesUpTo(Bound)]{};
+    size_t found = 0;
+    for (size_t number = 2; number <= Bound; number++) {
+        if (isPrimeNumber(number))
+            primes[found++] = static_cast<T>(number);
+    }
+    return StaticArrayDataSource<T, countPrimesUpTo(Bound)>(primes);
+}
+
+constexpr StaticArrayDataSource<int, 25> fibonacciTable = staticFibonacci<int, 25>();
+static_assert(fibonacciTable[24] == 46368, "Fibonacci table is wrong");
+
+constexpr StaticArrayDataSource<int, 25> primeTable = staticPrimes<int, 100>();
+static_assert(primeTable.size() == 25 && primeTable[0] == 2 && primeTable[24] == 97, "Prime table is wrong");
+
+//primes and fibonacci numbers in turn, the shorter table runs out first
+constexpr StaticArrayDataSource<int, 28> mixedTable = interleave(primeTable, staticFibonacci<int, 3>());
+static_assert(mixedTable[0] == 2 && mixedTable[1] == 0 && mixedTable[2] == 3 && mixedTable[3] == 1
+    && mixedTable[4] == 5 && mixedTable[5] == 1 && mixedTable[6] == 7 && mixedTable[7] == 11
+    && mixedTable[27] == 97, "Interleaved table is wrong");
+
+
 
 int generateRandomNumber() {
     return rand() % 100 + 1;  // chose  1-100
 }
 
-int* generateFibonacci() {
-    int* fibonacci = new int[25];
-    fibonacci[0] = 0;
-    fibonacci[1] = 1;
-    size_t current = 2;
+CoroutineGenerator<int> generateFibonacci() {
+    int previous = 0;
+    int current = 1;
 
-    while (current >= 2 && current < 25) {
-        fibonacci[current] = fibonacci[current - 1] + fibonacci[current - 2];
-        current++;
+    for (size_t i = 0; i < 25; i++) {
+        co_yield previous;
+        int following = previous + current;
+        previous = current;
+        current = following;
     }
-
-    return fibonacci; 
 }
 
 
@@ -721,7 +3375,7 @@ int main()
         PrimeGenerator primeGenerator;
         primeSource = new GeneratorDataSource<int, PrimeGenerator>(primeGenerator);
         randomSource = new GeneratorDataSource<int, int(*)()>(generateRandomNumber);
-        fibonacciSource = new ArrayDataSource<int>(generateFibonacci(), 25); 
+        fibonacciSource = new StaticArrayDataSource<int, 25>(fibonacciTable); //copies the table built by the compiler
         //if new fails it will be caught in the catch and will be delete after the try catch block (no problem deleting nullptr)
 
 
@@ -733,7 +3387,26 @@ int main()
             delete[] str;
         }
 
-        DataSource<int>* sources[] = { primeSource, randomSource, fibonacciSource };
+        //The coroutine builds the same numbers at runtime, it has to agree with the table from the compiler
+        CoroutineDataSource<int, CoroutineGenerator<int>(*)()> fibonacciCoroutine(generateFibonacci);
+        for (size_t i = 0; i < fibonacciTable.size(); i++) {
+            if (fibonacciCoroutine.next() != fibonacciTable[i]) {
+                throw std::runtime_error("Fibonacci coroutine does not match the table");
+            }
+        }
+        if (fibonacciCoroutine.hasNext()) {
+            throw std::runtime_error("Fibonacci coroutine produced too many numbers");
+        }
+
+        //Generators cannot reset on their own, the caches make the alternating source replayable
+        CachedDataSource<int> cachedPrimes(primeSource);
+        CachedDataSource<int> cachedRandom(randomSource);
+
+        InstrumentedDataSource<int> primeProbe(&cachedPrimes, "alternate/prime");
+        InstrumentedDataSource<int> randomProbe(&cachedRandom, "alternate/random");
+        InstrumentedDataSource<int> fibonacciProbe(fibonacciSource, "alternate/fibonacci");
+
+        DataSource<int>* sources[] = { &primeProbe, &randomProbe, &fibonacciProbe };
         AlternateDataSource<int> alternateSource(sources, 3);
 
         std::ofstream binaryFile("numbers.bin", std::ios::binary);
@@ -748,11 +3421,14 @@ int main()
             }
         }
         binaryFile.close();//Maybe no need for explicit close beacuse of RAII
+        DataSourceMetrics::print(std::cout);
 
-        std::ifstream binaryIn("numbers.bin", std::ios::binary);
-        if (!binaryIn.is_open()) {
-            throw std::runtime_error("Could not open binary file");
+        if (!alternateSource.reset()) {
+            throw std::runtime_error("Could not reset the alternating source");
         }
+        std::cout << "Replayed from the caches: " << alternateSource.next() << " " << alternateSource.next() << std::endl;
+
+        BinaryFileDataSource<int> binaryIn("numbers.bin"); //raw ints, exactly what was written above
 
         std::ofstream textFile("numbers.txt");
         if (!textFile.is_open()) {
@@ -760,7 +3436,7 @@ int main()
         }
 
         int number{};
-        while (binaryIn.read(reinterpret_cast<char*>(&number), sizeof(number))) {
+        while (binaryIn.tryNext(number)) {
             textFile << number << std::endl;
 
             if (!textFile) {
@@ -773,20 +3449,27 @@ int main()
             }
         }
 
-        if (binaryIn.fail() && !binaryIn.eof()) {
-            throw std::runtime_error("Error reading from binary file");
-        }
-
-
-        binaryIn.close();
         textFile.close();
 
         //Maybe no need for explicit close beacuse of RAII
 
         fileSource = new FileDataSource<int>("numbers.txt"); // maybe no need to be dyn
-        while (fileSource->hasNext()) {
-            std::cout << fileSource->next() << std::endl;
+        int value{};
+        while (fileSource->tryNext(value)) {
+            std::cout << value << std::endl;
         }
+
+        fileSource->reset();
+        WorkStealingPool pool;
+        long long total = parallelReduce(*fileSource, 0LL,
+            [](long long& sum, const int& element) { sum += element; },
+            [](long long& sum, const long long& part) { sum += part; }, pool);
+        std::cout << "Sum of the file computed in parallel: " << total << std::endl;
+
+        RunLoopExecutor loop;
+        DataSourceBatch<int> batch = syncWait(fileSource->nextBatchAsync(10, loop), loop);
+        std::cout << "Read " << batch.count << " numbers asynchronously" << std::endl;
+        delete[] batch.values;
     }
     catch (const std::runtime_error& e) {
         std::cerr << "Runtime error caught: " << e.what() << std::endl;